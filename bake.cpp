@@ -0,0 +1,850 @@
+#include "global.hpp"
+#include "dds.hpp"
+#include "mesh.hpp"
+#include "job.hpp"
+#include "rom.hpp"
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+/*
+ * Offline texture baker. Every texture the scenes reference is written next
+ * to its source as <file>.dds with a full mip chain in a BCn format, which
+ * tex_load prefers over the source image. So are the images r_glbegin binds
+ * outside the scenes, displacement maps as single channel BC4.
+ *
+ * Skybox cubemaps are baked into one file holding all six faces.
+ *
+ * matf_bake [-bc7] [-force] [file.mtl | image | -normal image | -height image | -cube out.dds +x -x +y -y +z -z]...
+ */
+
+enum bake_kind
+{
+	BAKE_COLOUR,
+	BAKE_NORMAL,
+	BAKE_HEIGHT, /* Red channel only. */
+	BAKE_KEYED, /* Colour, cyan marks transparent pixels. */
+	BAKE_CUBEMAP,
+};
+
+struct bake_file
+{
+	std::string path; /* Output file for cubemaps. */
+	enum bake_kind kind;
+	std::vector<std::string> face;
+};
+
+/* RGBA8. */
+struct bake_image
+{
+	uint32_t w;
+	uint32_t h;
+	std::vector<uint8_t> pixel;
+};
+
+static struct
+{
+	int bc7 = 0; /* BC7 instead of BC1/BC3 for colour. */
+	int force = 0; /* Bake even when the output is newer than the source. */
+} bake;
+
+/* Material libraries of the scenes. */
+static const char* bake_default_mtl[] = { "rom/part/parts.mtl", "rom/part/parts2.mtl", "rom/part/parts3.mtl" };
+
+/* Images gl.cpp binds outside the scenes. */
+static const struct
+{
+	const char* path;
+	enum bake_kind kind;
+} bake_default_image[] =
+{
+	{ "rom/normal_default.jpg", BAKE_NORMAL },
+	{ "rom/scene1.jpg", BAKE_COLOUR },
+	{ "rom/scene2.jpg", BAKE_COLOUR },
+	{ "rom/part/Cobblestone16_DISP_6K.jpg", BAKE_HEIGHT },
+	{ "rom/sun.png", BAKE_KEYED },
+};
+
+/* Skyboxes drawn by gl.cpp, output and faces in GL order. */
+static const char* bake_default_cube[][7] =
+{
+	{ "rom/cbb.dds", "rom/cbb_right.jpg", "rom/cbb_left.jpg", "rom/cbb_top.jpg", "rom/cbm_bottom.jpg", "rom/cbb_front.jpg", "rom/cbb_back.jpg" },
+	{ "rom/cbm.dds", "rom/cbm_left.jpg", "rom/cbm_right.jpg", "rom/cbm_top.jpg", "rom/cbm_bottom.jpg", "rom/cbm_back.jpg", "rom/cbm_front.jpg" },
+};
+
+/*
+ * Two endpoints minimizing the squared error of (1 - w) * a + w * b against
+ * the pixels, for the weights the current indices picked. Returns 1 when the
+ * system is singular.
+ */
+static int
+bake_fit(const float (*x)[4], const float* w, uint32_t channels, float* a, float* b)
+{
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f, det;
+	float ax[4] = { 0.0f, 0.0f, 0.0f, 0.0f }, bx[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+	for (uint32_t i = 0; i < 16; i++)
+	{
+		float u = 1.0f - w[i], v = w[i];
+
+		aa += u * u;
+		ab += u * v;
+		bb += v * v;
+		for (uint32_t c = 0; c < channels; c++)
+		{
+			ax[c] += u * x[i][c];
+			bx[c] += v * x[i][c];
+		}
+	}
+	det = aa * bb - ab * ab;
+	if (fabsf(det) < 1e-6f)
+	{
+		return 1;
+	}
+	for (uint32_t c = 0; c < channels; c++)
+	{
+		a[c] = glm::clamp((bb * ax[c] - ab * bx[c]) / det, 0.0f, 255.0f);
+		b[c] = glm::clamp((aa * bx[c] - ab * ax[c]) / det, 0.0f, 255.0f);
+	}
+	return 0;
+}
+
+/*
+ * Extremes of the block along its principal axis.
+ */
+static void
+bake_axis(const float (*x)[4], uint32_t channels, float* a, float* b)
+{
+	float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	float cov[4][4] = { };
+	float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	float lo = FLT_MAX, hi = -FLT_MAX;
+
+	for (uint32_t i = 0; i < 16; i++)
+	{
+		for (uint32_t c = 0; c < channels; c++)
+		{
+			mean[c] += x[i][c] / 16.0f;
+		}
+	}
+	for (uint32_t i = 0; i < 16; i++)
+	{
+		for (uint32_t r = 0; r < channels; r++)
+		{
+			for (uint32_t c = 0; c < channels; c++)
+			{
+				cov[r][c] += (x[i][r] - mean[r]) * (x[i][c] - mean[c]);
+			}
+		}
+	}
+	for (uint32_t k = 0; k < 8; k++)
+	{
+		float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f }, length = 0.0f;
+
+		for (uint32_t r = 0; r < channels; r++)
+		{
+			for (uint32_t c = 0; c < channels; c++)
+			{
+				next[r] += cov[r][c] * axis[c];
+			}
+			length = std::max(length, fabsf(next[r]));
+		}
+		if (length == 0.0f)
+		{
+			break;
+		}
+		for (uint32_t c = 0; c < channels; c++)
+		{
+			axis[c] = next[c] / length;
+		}
+	}
+	for (uint32_t i = 0; i < 16; i++)
+	{
+		float t = 0.0f;
+
+		for (uint32_t c = 0; c < channels; c++)
+		{
+			t += (x[i][c] - mean[c]) * axis[c];
+		}
+		lo = std::min(lo, t);
+		hi = std::max(hi, t);
+	}
+	{
+		float length = 0.0f;
+
+		for (uint32_t c = 0; c < channels; c++)
+		{
+			length += axis[c] * axis[c];
+		}
+		length = (length > 0.0f ? length : 1.0f);
+		for (uint32_t c = 0; c < channels; c++)
+		{
+			a[c] = glm::clamp(mean[c] + axis[c] * lo / length, 0.0f, 255.0f);
+			b[c] = glm::clamp(mean[c] + axis[c] * hi / length, 0.0f, 255.0f);
+		}
+	}
+}
+
+static uint16_t
+bake_565(const float* c)
+{
+	uint32_t r = (uint32_t)(c[0] * 31.0f / 255.0f + 0.5f);
+	uint32_t g = (uint32_t)(c[1] * 63.0f / 255.0f + 0.5f);
+	uint32_t b = (uint32_t)(c[2] * 31.0f / 255.0f + 0.5f);
+
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void
+bake_565_expand(uint16_t v, float* c)
+{
+	uint32_t r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+
+	c[0] = (float)((r << 3) | (r >> 2));
+	c[1] = (float)((g << 2) | (g >> 4));
+	c[2] = (float)((b << 3) | (b >> 2));
+}
+
+/*
+ * Four colour BC1 block. Fits along the principal axis and refines the
+ * endpoints with least squares twice.
+ */
+static void
+bake_bc1(const float (*x)[4], uint8_t* out)
+{
+	static const float weight[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+	float a[4], b[4], palette[4][3];
+	uint16_t c0 = 0, c1 = 0;
+	uint32_t index = 0;
+
+	bake_axis(x, 3, b, a);
+	for (uint32_t pass = 0; pass < 3; pass++)
+	{
+		float w[16];
+
+		c0 = bake_565(a);
+		c1 = bake_565(b);
+		if (c0 < c1)
+		{
+			std::swap(c0, c1);
+			std::swap(a, b);
+		}
+		bake_565_expand(c0, palette[0]);
+		bake_565_expand(c1, palette[1]);
+		for (uint32_t c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+			palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+		}
+		index = 0;
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			uint32_t best = 0;
+			float best_error = FLT_MAX;
+
+			for (uint32_t p = 0; p < (c0 == c1 ? 1u : 4u); p++)
+			{
+				float e = 0.0f;
+
+				for (uint32_t c = 0; c < 3; c++)
+				{
+					e += (x[i][c] - palette[p][c]) * (x[i][c] - palette[p][c]);
+				}
+				if (e < best_error)
+				{
+					best_error = e;
+					best = p;
+				}
+			}
+			index |= best << (2 * i);
+			w[i] = weight[best];
+		}
+		if (pass == 2 || c0 == c1 || bake_fit(x, w, 3, a, b))
+		{
+			break;
+		}
+	}
+	out[0] = (uint8_t)c0;
+	out[1] = (uint8_t)(c0 >> 8);
+	out[2] = (uint8_t)c1;
+	out[3] = (uint8_t)(c1 >> 8);
+	memcpy(out + 4, &index, 4);
+}
+
+/*
+ * Eight value BC4 block for channel c, as used for BC3 alpha, BC4 and BC5.
+ */
+static void
+bake_bc4(const float (*x)[4], uint32_t c, uint8_t* out)
+{
+	float lo = 255.0f, hi = 0.0f, palette[8];
+	uint64_t index = 0;
+	uint8_t a0, a1;
+
+	for (uint32_t i = 0; i < 16; i++)
+	{
+		lo = std::min(lo, x[i][c]);
+		hi = std::max(hi, x[i][c]);
+	}
+	a0 = (uint8_t)(hi + 0.5f);
+	a1 = (uint8_t)(lo + 0.5f);
+	palette[0] = a0;
+	palette[1] = a1;
+	for (uint32_t p = 1; p < 7; p++)
+	{
+		palette[p + 1] = ((7 - p) * a0 + p * a1) / 7.0f;
+	}
+	for (uint32_t i = 0; i < 16; i++)
+	{
+		uint64_t best = 0;
+
+		for (uint32_t p = 1; p < (a0 > a1 ? 8u : 1u); p++)
+		{
+			if (fabsf(x[i][c] - palette[p]) < fabsf(x[i][c] - palette[best]))
+			{
+				best = p;
+			}
+		}
+		index |= best << (3 * i);
+	}
+	out[0] = a0;
+	out[1] = a1;
+	for (uint32_t k = 0; k < 6; k++)
+	{
+		out[2 + k] = (uint8_t)(index >> (8 * k));
+	}
+}
+
+/*
+ * BC7 mode 6: one subset, RGBA endpoints with 7 bits and a p-bit each,
+ * 4 bit indices. Every p-bit combination is tried on the least squares fit.
+ */
+static void
+bake_bc7(const float (*x)[4], uint8_t* out)
+{
+	static const uint32_t weight[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+	float a[4], b[4];
+	uint32_t best_q[2][4] = { }, best_p[2] = { }, best_index[16] = { };
+	float best_error = FLT_MAX;
+
+	bake_axis(x, 4, a, b);
+	for (uint32_t pass = 0; pass < 2; pass++)
+	{
+		float w[16];
+
+		for (uint32_t pbit = 0; pbit < 4; pbit++)
+		{
+			uint32_t p[2] = { pbit & 1, pbit >> 1 };
+			uint32_t q[2][4], e[2][4], index[16];
+			float error = 0.0f;
+
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				q[0][c] = (uint32_t)glm::clamp((int)((a[c] - p[0]) / 2.0f + 0.5f), 0, 127);
+				q[1][c] = (uint32_t)glm::clamp((int)((b[c] - p[1]) / 2.0f + 0.5f), 0, 127);
+				e[0][c] = (q[0][c] << 1) | p[0];
+				e[1][c] = (q[1][c] << 1) | p[1];
+			}
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				float pixel_error = FLT_MAX;
+
+				for (uint32_t k = 0; k < 16; k++)
+				{
+					float d = 0.0f;
+
+					for (uint32_t c = 0; c < 4; c++)
+					{
+						float v = (float)(((64 - weight[k]) * e[0][c] + weight[k] * e[1][c] + 32) >> 6);
+
+						d += (x[i][c] - v) * (x[i][c] - v);
+					}
+					if (d < pixel_error)
+					{
+						pixel_error = d;
+						index[i] = k;
+					}
+				}
+				error += pixel_error;
+			}
+			if (error < best_error)
+			{
+				best_error = error;
+				memcpy(best_q, q, sizeof(q));
+				memcpy(best_p, p, sizeof(p));
+				memcpy(best_index, index, sizeof(index));
+			}
+		}
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			w[i] = weight[best_index[i]] / 64.0f;
+		}
+		if (bake_fit(x, w, 4, a, b))
+		{
+			break;
+		}
+	}
+
+	/* The first index has an implicit zero top bit. */
+	if (best_index[0] & 8)
+	{
+		std::swap(best_q[0], best_q[1]);
+		std::swap(best_p[0], best_p[1]);
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			best_index[i] = 15 - best_index[i];
+		}
+	}
+	{
+		uint64_t bits[2] = { 0, 0 };
+		uint32_t at = 0;
+
+		auto put = [&bits, &at](uint64_t value, uint32_t count)
+		{
+			for (uint32_t k = 0; k < count; k++, at++)
+			{
+				bits[at / 64] |= ((value >> k) & 1) << (at % 64);
+			}
+		};
+		put(1 << 6, 7);
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			put(best_q[0][c], 7);
+			put(best_q[1][c], 7);
+		}
+		put(best_p[0], 1);
+		put(best_p[1], 1);
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			put(best_index[i], i == 0 ? 3 : 4);
+		}
+		memcpy(out, bits, 16);
+	}
+}
+
+/*
+ * Box filtered half size image. Normals are renormalized.
+ */
+static void
+bake_downsample(const struct bake_image& in, struct bake_image* out, enum bake_kind kind)
+{
+	out->w = std::max(1u, in.w / 2);
+	out->h = std::max(1u, in.h / 2);
+	out->pixel.resize((size_t)out->w * out->h * 4);
+	for (uint32_t y = 0; y < out->h; y++)
+	{
+		for (uint32_t x = 0; x < out->w; x++)
+		{
+			float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			uint8_t* o = &out->pixel[((size_t)y * out->w + x) * 4];
+
+			for (uint32_t k = 0; k < 4; k++)
+			{
+				uint32_t sx = std::min(in.w - 1, x * 2 + (k & 1));
+				uint32_t sy = std::min(in.h - 1, y * 2 + (k >> 1));
+				const uint8_t* p = &in.pixel[((size_t)sy * in.w + sx) * 4];
+
+				for (uint32_t c = 0; c < 4; c++)
+				{
+					sum[c] += p[c] / 4.0f;
+				}
+			}
+			if (kind == BAKE_NORMAL)
+			{
+				glm::vec3 n = glm::vec3(sum[0], sum[1], sum[2]) / 127.5f - 1.0f;
+
+				n = (glm::length(n) > 0.0f ? glm::normalize(n) : glm::vec3(0.0f, 0.0f, 1.0f));
+				sum[0] = (n.x + 1.0f) * 127.5f;
+				sum[1] = (n.y + 1.0f) * 127.5f;
+				sum[2] = (n.z + 1.0f) * 127.5f;
+			}
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				o[c] = (uint8_t)glm::clamp(sum[c] + 0.5f, 0.0f, 255.0f);
+			}
+		}
+	}
+}
+
+/*
+ * Compresses one mip level, rows of blocks in parallel.
+ */
+static void
+bake_level(const struct bake_image& image, enum dds_format format, std::vector<uint8_t>* out)
+{
+	const uint32_t bw = (image.w + 3) / 4, bh = (image.h + 3) / 4;
+	const uint32_t block = dds_block_size(format);
+
+	out->resize((size_t)bw * bh * block);
+	job_parallel(bh, [&image, format, out, bw, block](uint32_t by)
+	{
+		for (uint32_t bx = 0; bx < bw; bx++)
+		{
+			float x[16][4];
+			uint8_t* o = out->data() + ((size_t)by * bw + bx) * block;
+
+			/* Edge blocks repeat the last row and column. */
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				uint32_t px = std::min(image.w - 1, bx * 4 + (i & 3));
+				uint32_t py = std::min(image.h - 1, by * 4 + (i >> 2));
+				const uint8_t* p = &image.pixel[((size_t)py * image.w + px) * 4];
+
+				for (uint32_t c = 0; c < 4; c++)
+				{
+					x[i][c] = p[c];
+				}
+			}
+			switch (format)
+			{
+			case DDS_BC1:
+				bake_bc1(x, o);
+				break;
+			case DDS_BC3:
+				bake_bc4(x, 3, o);
+				bake_bc1(x, o + 8);
+				break;
+			case DDS_BC4:
+				bake_bc4(x, 0, o);
+				break;
+			case DDS_BC5:
+				bake_bc4(x, 0, o);
+				bake_bc4(x, 1, o + 8);
+				break;
+			case DDS_BC7:
+				bake_bc7(x, o);
+				break;
+			}
+		}
+	});
+}
+
+static const char*
+bake_format_name(enum dds_format format)
+{
+	static const char* name[] = { "BC1", "BC3", "BC5", "BC7", "BC4" };
+
+	return name[format];
+}
+
+/*
+ * Encodes image and all its smaller levels, appended to level.
+ */
+static void
+bake_chain(struct bake_image image, enum dds_format format, enum bake_kind kind, std::vector<std::vector<uint8_t>>* level)
+{
+	for (uint32_t i = 0; ; i++)
+	{
+		level->emplace_back();
+		bake_level(image, format, &level->back());
+		if ((image.w == 1 && image.h == 1) || i + 1 == DDS_LEVELS_MAX)
+		{
+			break;
+		}
+		{
+			struct bake_image half;
+
+			bake_downsample(image, &half, kind);
+			image = std::move(half);
+		}
+	}
+}
+
+/*
+ * One line per baked file: size, format, levels and time taken.
+ */
+static void
+bake_report(std::ostream& log, const char* path, uint32_t w, uint32_t h, uint32_t faces, enum dds_format format, const std::vector<std::vector<uint8_t>>& level, std::chrono::steady_clock::time_point begin)
+{
+	size_t size = 0;
+
+	for (const std::vector<uint8_t>& l : level)
+	{
+		size += l.size();
+	}
+	log << "baked " << path << " " << w << "x" << h << (faces == 6 ? " cubemap " : " ") << bake_format_name(format) << ", " << level.size() / faces << " levels, "
+		<< (size_t)w * h * faces * 3 * 4 / 3 / 1024 << " KB -> " << size / 1024 << " KB in "
+		<< std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count() << " ms" << std::endl;
+}
+
+/*
+ * Six square faces of the same size, decoded in parallel. Up to date when
+ * the output is newer than every face. Messages go to log, like bake_file.
+ */
+static int
+bake_cube(const struct bake_file& f, std::ostream& log)
+{
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	std::vector<std::vector<uint8_t>> level;
+	struct bake_image face[6];
+	struct rom_info source, baked;
+	enum dds_format format;
+	int64_t newest = 0;
+	const char* failed[6] = { };
+	std::atomic<int> alpha(0);
+	uint32_t size;
+
+	for (const std::string& path : f.face)
+	{
+		if (rom_stat(path.c_str(), &source))
+		{
+			log << path << ": missing" << std::endl;
+			return 1;
+		}
+		newest = std::max(newest, source.mtime);
+	}
+	if (!bake.force && rom_stat(f.path.c_str(), &baked) == 0 && baked.mtime >= newest)
+	{
+		return 0;
+	}
+	job_parallel(6, [&f, &face, &alpha, &failed](uint32_t i)
+	{
+		int w, h, c;
+		uint8_t* data = stbi_load(f.face[i].c_str(), &w, &h, &c, 4);
+
+		if (data == nullptr)
+		{
+			failed[i] = stbi_failure_reason();
+			return;
+		}
+		face[i].w = (uint32_t)w;
+		face[i].h = (uint32_t)h;
+		face[i].pixel.assign(data, data + (size_t)w * h * 4);
+		stbi_image_free(data);
+		for (size_t k = 3; k < face[i].pixel.size() && (c == 2 || c == 4); k += 4)
+		{
+			if (face[i].pixel[k] != 255)
+			{
+				alpha = 1;
+				break;
+			}
+		}
+	});
+	for (uint32_t i = 0; i < 6; i++)
+	{
+		if (failed[i])
+		{
+			log << f.face[i] << ": " << failed[i] << std::endl;
+			return 1;
+		}
+	}
+	for (uint32_t i = 0; i < 6; i++)
+	{
+		if (face[i].w != face[0].w || face[i].h != face[0].w)
+		{
+			log << f.path << ": faces must be square and of the same size" << std::endl;
+			return 1;
+		}
+	}
+	size = face[0].w;
+
+	format = (bake.bc7 ? DDS_BC7 : alpha ? DDS_BC3 : DDS_BC1);
+	{
+		std::vector<std::vector<uint8_t>> chain[6];
+
+		job_parallel(6, [&face, &chain, format](uint32_t i)
+		{
+			bake_chain(std::move(face[i]), format, BAKE_COLOUR, &chain[i]);
+		});
+		for (uint32_t i = 0; i < 6; i++)
+		{
+			level.insert(level.end(), std::make_move_iterator(chain[i].begin()), std::make_move_iterator(chain[i].end()));
+		}
+	}
+
+	if (dds_write(f.path.c_str(), format, size, size, 6, level))
+	{
+		log << f.path << ": write failed" << std::endl;
+		return 1;
+	}
+	bake_report(log, f.path.c_str(), size, size, 6, format, level, begin);
+	return 0;
+}
+
+/*
+ * Returns 0 when the output is written or already up to date. Runs on a
+ * worker, so messages go to log for the caller to print.
+ */
+static int
+bake_file(const struct bake_file& f, std::ostream& log)
+{
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	const std::string out_path = f.path + ".dds";
+	std::vector<std::vector<uint8_t>> level;
+	struct bake_image image;
+	struct rom_info source, baked;
+	enum dds_format format;
+	int alpha = 0;
+	int w, h, c;
+	uint8_t* data;
+
+	if (rom_stat(f.path.c_str(), &source))
+	{
+		log << f.path << ": missing" << std::endl;
+		return 1;
+	}
+	if (!bake.force && rom_stat(out_path.c_str(), &baked) == 0 && baked.mtime >= source.mtime)
+	{
+		return 0;
+	}
+	data = stbi_load(f.path.c_str(), &w, &h, &c, 4);
+	if (data == nullptr)
+	{
+		log << f.path << ": " << stbi_failure_reason() << std::endl;
+		return 1;
+	}
+	image.w = (uint32_t)w;
+	image.h = (uint32_t)h;
+	image.pixel.assign(data, data + (size_t)w * h * 4);
+	stbi_image_free(data);
+	for (size_t i = 3; i < image.pixel.size() && (c == 2 || c == 4); i += 4)
+	{
+		alpha |= (image.pixel[i] != 255);
+	}
+	for (size_t i = 0; i < image.pixel.size() && f.kind == BAKE_KEYED; i += 4)
+	{
+		/* Block compression does not keep the key colour exact, alpha it does. */
+		if (image.pixel[i + 0] == 0 && image.pixel[i + 1] == 255 && image.pixel[i + 2] == 255)
+		{
+			memset(&image.pixel[i], 0, 4);
+			alpha = 1;
+		}
+	}
+
+	if (f.kind == BAKE_NORMAL)
+	{
+		format = DDS_BC5;
+	}
+	else if (f.kind == BAKE_HEIGHT)
+	{
+		format = DDS_BC4;
+	}
+	else
+	{
+		format = (bake.bc7 ? DDS_BC7 : alpha ? DDS_BC3 : DDS_BC1);
+	}
+
+	bake_chain(std::move(image), format, f.kind, &level);
+	if (dds_write(out_path.c_str(), format, (uint32_t)w, (uint32_t)h, 1, level))
+	{
+		log << out_path << ": write failed" << std::endl;
+		return 1;
+	}
+	bake_report(log, out_path.c_str(), (uint32_t)w, (uint32_t)h, 1, format, level, begin);
+	return 0;
+}
+
+/*
+ * Textures of a material library, paths are relative to the library.
+ */
+static void
+bake_mtl(const char* path, std::vector<struct bake_file>* out)
+{
+	std::vector<struct mesh_material> material;
+	std::string dir = path;
+
+	dir = dir.substr(0, dir.find_last_of("/\\") + 1);
+	if (mesh_load_mtl(&material, path))
+	{
+		return;
+	}
+	for (const struct mesh_material& m : material)
+	{
+		if (!m.diffuse_path.empty())
+		{
+			out->push_back({ dir + m.diffuse_path, BAKE_COLOUR });
+		}
+		if (!m.normal_path.empty())
+		{
+			out->push_back({ dir + m.normal_path, BAKE_NORMAL });
+		}
+	}
+}
+
+int
+main(int argc, char** argv)
+{
+	std::vector<struct bake_file> file;
+	std::vector<std::ostringstream> log;
+	std::vector<int> failed;
+	int inputs = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const size_t length = strlen(argv[i]);
+
+		if (strcmp(argv[i], "-bc7") == 0)
+		{
+			bake.bc7 = 1;
+		}
+		else if (strcmp(argv[i], "-force") == 0)
+		{
+			bake.force = 1;
+		}
+		else if (strcmp(argv[i], "-normal") == 0 && i + 1 < argc)
+		{
+			file.push_back({ argv[++i], BAKE_NORMAL, { } });
+			inputs++;
+		}
+		else if (strcmp(argv[i], "-height") == 0 && i + 1 < argc)
+		{
+			file.push_back({ argv[++i], BAKE_HEIGHT, { } });
+			inputs++;
+		}
+		else if (strcmp(argv[i], "-cube") == 0 && i + 7 < argc)
+		{
+			file.push_back({ argv[i + 1], BAKE_CUBEMAP, std::vector<std::string>(argv + i + 2, argv + i + 8) });
+			i += 7;
+			inputs++;
+		}
+		else if (length > 4 && strcmp(argv[i] + length - 4, ".mtl") == 0)
+		{
+			bake_mtl(argv[i], &file);
+			inputs++;
+		}
+		else
+		{
+			file.push_back({ argv[i], BAKE_COLOUR, { } });
+			inputs++;
+		}
+	}
+	if (inputs == 0)
+	{
+		for (const char* mtl : bake_default_mtl)
+		{
+			bake_mtl(mtl, &file);
+		}
+		for (const auto& image : bake_default_image)
+		{
+			file.push_back({ image.path, image.kind, { } });
+		}
+		for (const auto& cube : bake_default_cube)
+		{
+			file.push_back({ cube[0], BAKE_CUBEMAP, std::vector<std::string>(cube + 1, cube + 7) });
+		}
+	}
+
+	/* A texture used by several materials is baked once. */
+	std::sort(file.begin(), file.end(), [](const struct bake_file& a, const struct bake_file& b) { return a.path < b.path; });
+	file.erase(std::unique(file.begin(), file.end(), [](const struct bake_file& a, const struct bake_file& b) { return a.path == b.path; }), file.end());
+
+	job_begin(std::max(1, (int)std::thread::hardware_concurrency()) - 1);
+	log.resize(file.size());
+	failed.resize(file.size());
+	job_parallel((uint32_t)file.size(), [&file, &log, &failed](uint32_t i)
+	{
+		failed[i] = (file[i].kind == BAKE_CUBEMAP ? bake_cube(file[i], log[i]) : bake_file(file[i], log[i]));
+	});
+	job_end();
+	/* Once every job is done, in file order, so lines do not interleave. */
+	for (const std::ostringstream& l : log)
+	{
+		std::cout << l.str();
+	}
+
+	return (std::find(failed.begin(), failed.end(), 1) != failed.end());
+}
@@ -0,0 +1,214 @@
+#include "global.hpp"
+#include "dds.hpp"
+#include <cstring>
+
+#define DDS_FOURCC(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+#define DDSD_REQUIRED (0x1 | 0x2 | 0x4 | 0x1000) /* Caps, height, width, pixel format. */
+#define DDSD_MIPMAPCOUNT 0x20000
+#define DDSD_LINEARSIZE 0x80000
+#define DDPF_FOURCC 0x4
+#define DDSCAPS_COMPLEX 0x8
+#define DDSCAPS_TEXTURE 0x1000
+#define DDSCAPS_MIPMAP 0x400000
+#define DDSCAPS2_CUBEMAP 0x200
+#define DDSCAPS2_CUBEMAP_ALLFACES 0xfc00
+#define DDS_RESOURCE_MISC_TEXTURECUBE 0x4
+#define DXGI_FORMAT_BC4_UNORM 80
+#define DXGI_FORMAT_BC5_UNORM 83
+#define DXGI_FORMAT_BC7_UNORM 98
+
+struct dds_header
+{
+	uint32_t magic;
+	uint32_t size;
+	uint32_t flags;
+	uint32_t height;
+	uint32_t width;
+	uint32_t linear_size;
+	uint32_t depth;
+	uint32_t levels;
+	uint32_t reserved1[11];
+	struct
+	{
+		uint32_t size;
+		uint32_t flags;
+		uint32_t fourcc;
+		uint32_t bits;
+		uint32_t mask[4];
+	} format;
+	uint32_t caps[4];
+	uint32_t reserved2;
+};
+
+struct dds_header_dx10
+{
+	uint32_t format;
+	uint32_t dimension;
+	uint32_t flags;
+	uint32_t array_size;
+	uint32_t flags2;
+};
+
+uint32_t
+dds_block_size(enum dds_format format)
+{
+	return (format == DDS_BC1 || format == DDS_BC4 ? 8 : 16);
+}
+
+uint32_t
+dds_level_size(enum dds_format format, uint32_t w, uint32_t h)
+{
+	return ((w + 3) / 4) * ((h + 3) / 4) * dds_block_size(format);
+}
+
+/*
+ * Accepts what dds_write produces: a 2D texture or a cubemap with all six
+ * faces, in one of the dds_format encodings with its mip chain.
+ */
+int
+dds_parse(struct dds_image* d, const uint8_t* data, size_t size)
+{
+	struct dds_header header;
+	size_t at = sizeof(header);
+	uint32_t w, h;
+	int cube;
+
+	if (size < sizeof(header))
+	{
+		return 1;
+	}
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != DDS_FOURCC('D', 'D', 'S', ' ') || header.size != 124 || !(header.format.flags & DDPF_FOURCC) || header.width == 0 || header.height == 0)
+	{
+		return 1;
+	}
+	cube = ((header.caps[1] & DDSCAPS2_CUBEMAP) != 0);
+	if (cube && (header.caps[1] & DDSCAPS2_CUBEMAP_ALLFACES) != DDSCAPS2_CUBEMAP_ALLFACES)
+	{
+		return 1;
+	}
+	if (header.format.fourcc == DDS_FOURCC('D', 'X', 'T', '1'))
+	{
+		d->format = DDS_BC1;
+	}
+	else if (header.format.fourcc == DDS_FOURCC('D', 'X', 'T', '5'))
+	{
+		d->format = DDS_BC3;
+	}
+	else if (header.format.fourcc == DDS_FOURCC('D', 'X', '1', '0') && size >= at + sizeof(struct dds_header_dx10))
+	{
+		struct dds_header_dx10 dx10;
+
+		memcpy(&dx10, data + at, sizeof(dx10));
+		at += sizeof(dx10);
+		if (dx10.format == DXGI_FORMAT_BC4_UNORM)
+		{
+			d->format = DDS_BC4;
+		}
+		else if (dx10.format == DXGI_FORMAT_BC5_UNORM)
+		{
+			d->format = DDS_BC5;
+		}
+		else if (dx10.format == DXGI_FORMAT_BC7_UNORM)
+		{
+			d->format = DDS_BC7;
+		}
+		else
+		{
+			return 1;
+		}
+	}
+	else
+	{
+		return 1;
+	}
+
+	d->w = header.width;
+	d->h = header.height;
+	d->levels = ((header.flags & DDSD_MIPMAPCOUNT) && header.levels > 0 ? header.levels : 1);
+	d->faces = (cube ? 6 : 1);
+	d->face_size = 0;
+	if (d->levels > DDS_LEVELS_MAX || (cube && d->w != d->h))
+	{
+		return 1;
+	}
+	w = d->w;
+	h = d->h;
+	for (uint32_t i = 0; i < d->levels; i++)
+	{
+		d->size[i] = dds_level_size(d->format, w, h);
+		if (at + d->size[i] > size)
+		{
+			return 1;
+		}
+		d->level[i] = data + at;
+		at += d->size[i];
+		d->face_size += d->size[i];
+		w = std::max(1u, w / 2);
+		h = std::max(1u, h / 2);
+	}
+	if ((size_t)(d->level[0] - data) + d->face_size * d->faces > size)
+	{
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * BC1 and BC3 use the legacy FourCC header, BC4, BC5 and BC7 the DX10 one.
+ * level holds the levels of each face in turn. Written to a temporary file
+ * first, like the mesh cache.
+ */
+int
+dds_write(const char* path, enum dds_format format, uint32_t w, uint32_t h, uint32_t faces, const std::vector<std::vector<uint8_t>>& level)
+{
+	struct dds_header header = { };
+	struct dds_header_dx10 dx10 = { };
+	const std::string temp_path = std::string(path) + ".tmp";
+	int dx = (format == DDS_BC4 || format == DDS_BC5 || format == DDS_BC7);
+
+	header.magic = DDS_FOURCC('D', 'D', 'S', ' ');
+	header.size = 124;
+	header.flags = DDSD_REQUIRED | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+	header.height = h;
+	header.width = w;
+	header.linear_size = dds_level_size(format, w, h);
+	header.levels = (uint32_t)(level.size() / faces);
+	header.format.size = 32;
+	header.format.flags = DDPF_FOURCC;
+	header.format.fourcc = (dx ? DDS_FOURCC('D', 'X', '1', '0') : format == DDS_BC1 ? DDS_FOURCC('D', 'X', 'T', '1') : DDS_FOURCC('D', 'X', 'T', '5'));
+	header.caps[0] = DDSCAPS_TEXTURE | (header.levels > 1 ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0) | (faces == 6 ? DDSCAPS_COMPLEX : 0);
+	header.caps[1] = (faces == 6 ? DDSCAPS2_CUBEMAP | DDSCAPS2_CUBEMAP_ALLFACES : 0);
+	dx10.format = (format == DDS_BC4 ? DXGI_FORMAT_BC4_UNORM : format == DDS_BC5 ? DXGI_FORMAT_BC5_UNORM : DXGI_FORMAT_BC7_UNORM);
+	dx10.dimension = 3; /* Texture 2D. */
+	dx10.flags = (faces == 6 ? DDS_RESOURCE_MISC_TEXTURECUBE : 0);
+	dx10.array_size = 1;
+
+	{
+		std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+
+		out.write((const char*)&header, sizeof(header));
+		if (dx)
+		{
+			out.write((const char*)&dx10, sizeof(dx10));
+		}
+		for (const std::vector<uint8_t>& l : level)
+		{
+			out.write((const char*)l.data(), l.size());
+		}
+		if (!out)
+		{
+			out.close();
+			std::remove(temp_path.c_str());
+			return 1;
+		}
+	}
+
+	std::remove(path);
+	if (std::rename(temp_path.c_str(), path) != 0)
+	{
+		std::remove(temp_path.c_str());
+		return 1;
+	}
+	return 0;
+}
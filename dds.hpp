@@ -0,0 +1,35 @@
+#pragma once
+
+#define DDS_LEVELS_MAX 16
+
+/* Block compressed formats written by matf_bake. */
+enum dds_format
+{
+	DDS_BC1, /* RGB, 8 bytes per block */
+	DDS_BC3, /* RGBA, 16 bytes per block */
+	DDS_BC5, /* RG, 16 bytes per block */
+	DDS_BC7, /* RGBA, 16 bytes per block */
+	DDS_BC4, /* R, 8 bytes per block */
+};
+
+/*
+ * DDS file parsed in place, levels point into the file data. Cubemaps store
+ * the faces one after another in GL order, each with all levels: level i of
+ * face f is at level[i] + f * face_size.
+ */
+struct dds_image
+{
+	enum dds_format format;
+	uint32_t w;
+	uint32_t h;
+	uint32_t levels;
+	uint32_t faces; /* 1 or 6. */
+	size_t face_size;
+	const uint8_t* level[DDS_LEVELS_MAX];
+	uint32_t size[DDS_LEVELS_MAX];
+};
+
+extern uint32_t dds_block_size(enum dds_format format);
+extern uint32_t dds_level_size(enum dds_format format, uint32_t w, uint32_t h);
+extern int dds_parse(struct dds_image* d, const uint8_t* data, size_t size);
+extern int dds_write(const char* path, enum dds_format format, uint32_t w, uint32_t h, uint32_t faces, const std::vector<std::vector<uint8_t>>& level);
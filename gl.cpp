@@ -1,22 +1,105 @@
 #include "global.hpp"
 #include "gl.hpp"
+#include "mesh.hpp"
+#include "job.hpp"
+#include "texture.hpp"
+#include "rom.hpp"
+#include "dds.hpp"
+#include "program.hpp"
+#include "queue.hpp"
+#include "ring.hpp"
+#include "state.hpp"
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <thread>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#define DISPLAY_SETTLE_MS 150
+/*
+ * global_get uploads on a unit no pass samples from, since it is called in
+ * the middle of binding a draw's textures.
+ */
+#define GLOBAL_UPLOAD_UNIT STATE_UNITS
+
+/* Uniform block binding points of the scene programs. */
+#define BLOCK_FRAME 0
+#define BLOCK_MATERIAL 1
+/* Materials in material_block, a scene with more binds them in pages. */
+#define MATERIAL_MAX 256
+
 struct object
 {
 	uint32_t vcount;
 	uint32_t vfirst;
-	std::string material;
-	std::string name;
+	uint32_t icount;
+	uint32_t ifirst;
+	uint32_t material; /* Index into scene_data::material. */
+	uint32_t name; /* Index into scene_data::object_name. */
+	int parallax = 0; /* Samples the displacement map, objects named PAR. */
 	glm::vec3 explicit_position = { 0.0f, 0.0f, 0.0f };
+	glm::vec3 position_offset = { 0.0f, 0.0f, 0.0f }; /* Packed vertices only, position * scale + offset. */
+	glm::vec3 position_scale = { 1.0f, 1.0f, 1.0f };
+	glm::vec3 center = { 0.0f, 0.0f, 0.0f }; /* Bounding sphere, for texture streaming. */
+	float radius = 0.0f;
+	float uv_span = 1.0f; /* Texture repeats across the object. */
+};
+
+/*
+ * Opaque objects of one material and parallax map, drawn together with
+ * -batch static. Packed vertices of the objects share the batch bounds.
+ */
+struct batch
+{
+	uint32_t material;
+	int parallax;
+	glm::vec3 position_offset = { 0.0f, 0.0f, 0.0f };
+	glm::vec3 position_scale = { 1.0f, 1.0f, 1.0f };
+	std::vector<GLsizei> count;
+	std::vector<const void*> offset; /* Into the index buffer, in bytes. */
+	std::vector<GLint> basevertex;
+};
+
+enum global_state
+{
+	GLOBAL_IDLE, /* Not used yet. */
+	GLOBAL_DECODING,
+	GLOBAL_DECODED,
+	GLOBAL_READY,
+	GLOBAL_FAILED,
+};
+
+/*
+ * Image that is not part of a scene. Decoded on a worker the first time it
+ * is bound and uploaded on the next bind, global_get returns the fallback
+ * until then. A baked file from matf_bake replaces the decode when it is
+ * newer than every face.
+ */
+struct global_image
+{
+	GLenum target; /* GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP, six faces. */
+	const char* path[6];
+	const char* baked;
+	GLint filter;
+	GLint wrap;
+	std::atomic<int> state;
+	uint8_t* pixels[6];
+	int w[6];
+	int h[6];
+	int c[6];
+	struct rom_file file; /* Baked, mapped until uploaded. */
+	struct dds_image dds;
+	GLuint id;
 };
 
 struct billboard
 {
 	glm::vec3 position;
 	glm::vec3 facing;
-	uint32_t texture;
+	struct global_image* image;
 };
 
 struct material
@@ -25,8 +108,29 @@ struct material
 	glm::vec3 diffuse = { 1.0f, 1.0f, 1.0f }; /* Kd */
 	glm::vec4 specular = { 0.0f, 0.0f, 0.0f, 20.0 }; /* Ks, Ns */
 	float transparency = 0.0f;
-	uint32_t diffuse_texture = 0;   /* map_Kd */
-	uint32_t normal_texture = 0;   /* bump */
+	uint32_t diffuse_texture = 0;   /* map_Kd, tex handle */
+	uint32_t normal_texture = 0;   /* bump, tex handle */
+};
+
+/*
+ * std140 layout of frame_block in default_vert.glsl.
+ */
+struct frame_block
+{
+	glm::mat4 viewproj;
+	glm::vec4 eye;
+	glm::vec4 distant_light_dir;
+};
+
+/*
+ * std140 layout of one material in material_block, material[o.material]
+ * read by default_frag.glsl.
+ */
+struct material_block
+{
+	glm::vec4 ambient; /* w: transparency */
+	glm::vec4 diffuse;
+	glm::vec4 specular;
 };
 
 /*
@@ -56,29 +160,108 @@ struct trackball
 	glm::vec3 p_z;
 };
 
-static struct
+/*
+ * Everything one scene draws with. The active scene keeps rendering while
+ * the next one is staged in a second scene_data.
+ */
+struct scene_data
 {
-	uint32_t vbo, vbo_sky, vbo_bb, vbo_line, vbo_ppfx;
-	uint32_t vao, vao_sky, vao_bb, vao_line, vao_ppfx;
+	enum scene scene = scene::SCENE_VOID;
 	std::vector<struct object> object;
 	std::vector<struct object> object_transparent;
+	std::vector<struct batch> batch; /* Ordered by material, empty without -batch static. */
+	std::vector<struct material> material; /* Indexed by object::material. */
+	std::vector<std::string> material_name; /* Same order, not used while drawing. */
+	std::vector<std::string> object_name;
+	uint32_t vbo = 0, ibo = 0, vao = 0;
+	uint32_t vbo_line = 0, vao_line = 0;
+	GLenum index_type = GL_UNSIGNED_SHORT;
+};
+
+enum stage_state
+{
+	STAGE_PARSING, /* Worker reads the mesh and material library. */
+	STAGE_PARSED,
+	STAGE_UPLOADING, /* Buffers are filled a slice per frame. */
+	STAGE_TEXTURES, /* Waits until every texture shows something. */
+	STAGE_FAILED,
+};
+
+/*
+ * Scene being loaded. The worker fills in everything up to STAGE_PARSED,
+ * the render thread takes it from there.
+ */
+struct scene_stage
+{
+	struct scene_data data;
+	std::atomic<int> state;
+	std::string mesh_path;
+	std::string material_path;
+	std::vector<struct mesh_material> mtl;
+	std::map<std::string, uint32_t> material_index; /* Name to index, only while loading. */
+	struct mesh_cache cache = { };
+	struct mesh mesh;
+	std::vector<uint8_t> index;
+	std::vector<struct mesh_vertex_packed> packed;
+	const uint8_t* vertex_data = nullptr;
+	const uint8_t* index_data = nullptr;
+	size_t vertex_bytes = 0;
+	size_t index_bytes = 0;
+	size_t uploaded = 0; /* Vertex bytes, then index bytes. */
+	uint32_t vertex_count = 0;
+	std::chrono::steady_clock::time_point begin;
+};
+
+/* Camera and sun a scene starts with. */
+struct scene_view
+{
+	float pitch;
+	float yaw;
+	glm::vec3 focus;
+	float radius;
+	glm::vec3 sun;
+};
+
+static struct
+{
+	uint32_t vbo_sky, vbo_bb, vbo_ppfx;
+	uint32_t vao_sky, vao_bb, vao_ppfx;
+	struct scene_data active;
+	std::shared_ptr<struct scene_stage> stage;
+	enum scene requested = scene::SCENE_VOID;
 	std::vector<struct billboard> billboard;
-	std::map<std::string, struct material> material;
+	struct queue queue; /* Opaque objects of this frame, payload is the object index. */
+	struct ring ring; /* frame_block, then the material pages. */
+	uint32_t material_page; /* Bound to BLOCK_MATERIAL. */
+	int block_failed; /* material_block is above the driver's limit, nothing reads the blocks. */
+	uint32_t ring_failed; /* Ring size that could not be created, not tried again. */
+	int report; /* Print the state calls of the next frame. */
 
 	GLuint texture_white;
-	GLuint texture_normal;
-	GLuint texture_scene1;
-	GLuint texture_scene2;
-	GLuint texture_cubemap2;
-	GLuint texture_cubemap;
-	GLuint texture_billboard_sunguy;
+	GLuint texture_flat; /* Normal pointing straight out. */
+	GLuint texture_grey; /* Cubemap. */
+	struct global_image image_normal = { GL_TEXTURE_2D, { "rom/normal_default.jpg" }, "rom/normal_default.jpg.dds", GL_LINEAR, GL_REPEAT };
+	struct global_image image_scene1 = { GL_TEXTURE_2D, { "rom/scene1.jpg" }, "rom/scene1.jpg.dds", GL_LINEAR, GL_REPEAT };
+	struct global_image image_scene2 = { GL_TEXTURE_2D, { "rom/scene2.jpg" }, "rom/scene2.jpg.dds", GL_LINEAR, GL_REPEAT };
+	struct global_image image_displace = { GL_TEXTURE_2D, { "rom/part/Cobblestone16_DISP_6K.jpg" }, "rom/part/Cobblestone16_DISP_6K.jpg.dds", GL_LINEAR, GL_REPEAT };
+	struct global_image image_sun = { GL_TEXTURE_2D, { "rom/sun.png" }, "rom/sun.png.dds", GL_NEAREST, GL_REPEAT };
+	struct global_image image_cubemap = { GL_TEXTURE_CUBE_MAP, { "rom/cbb_right.jpg", "rom/cbb_left.jpg", "rom/cbb_top.jpg", "rom/cbm_bottom.jpg", "rom/cbb_front.jpg", "rom/cbb_back.jpg" }, "rom/cbb.dds", GL_LINEAR, GL_CLAMP_TO_EDGE };
+	struct global_image image_cubemap2 = { GL_TEXTURE_CUBE_MAP, { "rom/cbm_left.jpg", "rom/cbm_right.jpg", "rom/cbm_top.jpg", "rom/cbm_bottom.jpg", "rom/cbm_back.jpg", "rom/cbm_front.jpg" }, "rom/cbm.dds", GL_LINEAR, GL_CLAMP_TO_EDGE };
 	GLuint texture_fb_display;
-	GLuint texture_displace_test;
 
 	GLuint fb_display;
 
 	GLuint rbo;
 
+	/* Window size from r_resize, the framebuffer follows once it settles. */
+	struct
+	{
+		int w;
+		int h;
+		int pending;
+		std::chrono::steady_clock::time_point last;
+	} window;
+
 	struct trackball trackball;
 
 	struct
@@ -86,18 +269,16 @@ static struct
 		uint32_t id;
 		struct
 		{
-			uint32_t mvp;
-			uint32_t eye;
-			uint32_t ambient;
-			uint32_t specular;
-			uint32_t transparency;
-			uint32_t diffuse;
-			uint32_t distant_light_dir;
+			uint32_t material;
 			uint32_t imgtexture;
 			uint32_t normalmap;
 			uint32_t model;
 			uint32_t parallaxmap;
+			uint32_t position_offset;
+			uint32_t position_scale;
 		} uniform;
+		uint32_t handle;
+		uint32_t fallback; /* Program drawn with until handle links, 0 after. */
 	} program;
 
 	struct
@@ -108,6 +289,7 @@ static struct
 			uint32_t mvp;
 			uint32_t gamma;
 		} uniform;
+		uint32_t handle;
 	} program_sky;
 
 	struct
@@ -118,6 +300,7 @@ static struct
 			uint32_t mvp;
 			uint32_t screenwh;
 		} uniform;
+		uint32_t handle;
 	} program_bb;
 
 	struct
@@ -128,6 +311,7 @@ static struct
 			uint32_t mvp;
 			uint32_t colour;
 		} uniform;
+		uint32_t handle;
 	} program_line;
 
 	struct
@@ -138,9 +322,8 @@ static struct
 			uint32_t imgtexture;
 			uint32_t display_resolution;
 		} uniform;
+		uint32_t handle;
 	} program_display;
-
-	enum scene scene = scene::SCENE_VOID;
 } gl;
 
 /*
@@ -234,136 +417,321 @@ cam_trackball(struct trackball* c)
 	}
 }
 
-static uint32_t
-program_module_compile(GLenum type, const char* file_path)
+/*
+ * stbi_load through rom_map, so images can come from rom.pak.
+ */
+static uint8_t*
+image_load(const char* path, int* w, int* h, int* c)
 {
-	std::ifstream file(file_path);
-	std::stringstream sourcestream;
-	std::string source;
-	uint32_t shadermodule;
-	const char* csource;
-
-	sourcestream << file.rdbuf();
-	source = sourcestream.str();
-	csource = source.c_str();
-	shadermodule = glCreateShader(type);
-	glShaderSource(shadermodule, 1, &csource, NULL);
-	glCompileShader(shadermodule);
-	return shadermodule;
+	struct rom_file file;
+	uint8_t* data = nullptr;
+
+	if (rom_map(&file, path) == 0)
+	{
+		data = stbi_load_from_memory(file.data, (int)file.size, w, h, c, 0);
+		rom_unmap(&file);
+	}
+	return data;
 }
 
-static uint32_t
-program_new(const char* vertex_file_path, const char* fragment_file_path, int which)
+/*
+ * Maps the baked file when it is at least as new as every face and its
+ * format is in supported, a mask of dds_format bits.
+ */
+static int
+global_baked(struct global_image* g, uint32_t faces, uint32_t supported)
+{
+	struct rom_info baked, source;
+
+	if (g->baked == nullptr || rom_stat(g->baked, &baked))
+	{
+		return 1;
+	}
+	for (uint32_t i = 0; i < faces; i++)
+	{
+		if (rom_stat(g->path[i], &source) == 0 && source.mtime > baked.mtime)
+		{
+			return 1;
+		}
+	}
+	if (rom_map(&g->file, g->baked))
+	{
+		return 1;
+	}
+	if (dds_parse(&g->dds, g->file.data, g->file.size) || g->dds.faces != faces || !(supported & (1u << g->dds.format)))
+	{
+		std::cout << "image " << g->baked << " not usable, decoding the source" << std::endl;
+		rom_unmap(&g->file);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * The image's texture, or fallback while it is decoded. The first call
+ * starts decoding, faces in parallel, and a later call uploads it, all
+ * faces and levels of a baked file at once. Images that fail to decode
+ * keep returning the fallback.
+ */
+static GLuint
+global_get(struct global_image* g, GLuint fallback)
+{
+	const uint32_t faces = (g->target == GL_TEXTURE_CUBE_MAP ? 6 : 1);
+	GLint alignment;
+	int failed = 0;
+
+	switch (g->state.load(std::memory_order_acquire))
+	{
+	case GLOBAL_READY:
+		return g->id;
+	case GLOBAL_IDLE:
+	{
+		uint32_t supported = 0;
+
+		/* Asked here, the workers have no GL context. */
+		for (int format : { DDS_BC1, DDS_BC3, DDS_BC4, DDS_BC5, DDS_BC7 })
+		{
+			supported |= (tex_compressed(format) ? 1u << format : 0);
+		}
+		g->state = GLOBAL_DECODING;
+		job_push([g, faces, supported]()
+		{
+			if (global_baked(g, faces, supported))
+			{
+				job_parallel(faces, [g](uint32_t i)
+				{
+					g->pixels[i] = image_load(g->path[i], &g->w[i], &g->h[i], &g->c[i]);
+				});
+			}
+			g->state.store(GLOBAL_DECODED, std::memory_order_release);
+		});
+		return fallback;
+	}
+	case GLOBAL_DECODED:
+		break;
+	default:
+		return fallback;
+	}
+
+	if (g->file.data)
+	{
+		const GLenum internal = tex_compressed(g->dds.format);
+
+		glGenTextures(1, &g->id);
+		state_texture(GLOBAL_UPLOAD_UNIT, g->target, g->id);
+		for (uint32_t i = 0; i < faces; i++)
+		{
+			const GLenum target = (faces == 6 ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + i : g->target);
+
+			for (uint32_t l = 0; l < g->dds.levels; l++)
+			{
+				glCompressedTexImage2D(target, l, internal, std::max(1u, g->dds.w >> l), std::max(1u, g->dds.h >> l), 0, g->dds.size[l], g->dds.level[l] + i * g->dds.face_size);
+			}
+		}
+		glTexParameteri(g->target, GL_TEXTURE_MAX_LEVEL, g->dds.levels - 1);
+		glTexParameteri(g->target, GL_TEXTURE_MIN_FILTER, (g->dds.levels > 1 && g->filter == GL_LINEAR ? GL_LINEAR_MIPMAP_LINEAR : g->filter));
+		glTexParameteri(g->target, GL_TEXTURE_MAG_FILTER, g->filter);
+		glTexParameteri(g->target, GL_TEXTURE_WRAP_S, g->wrap);
+		glTexParameteri(g->target, GL_TEXTURE_WRAP_T, g->wrap);
+		glTexParameteri(g->target, GL_TEXTURE_WRAP_R, g->wrap);
+		rom_unmap(&g->file);
+		g->state = GLOBAL_READY;
+		return g->id;
+	}
+
+	for (uint32_t i = 0; i < faces; i++)
+	{
+		if (g->pixels[i] == nullptr || (g->c[i] != 3 && g->c[i] != 4))
+		{
+			std::cout << "image issue " << g->path[i] << std::endl;
+			failed = 1;
+		}
+	}
+	if (!failed)
+	{
+		glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glGenTextures(1, &g->id);
+		state_texture(GLOBAL_UPLOAD_UNIT, g->target, g->id);
+		for (uint32_t i = 0; i < faces; i++)
+		{
+			const GLenum target = (faces == 6 ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + i : g->target);
+
+			glTexImage2D(target, 0, GL_RGB, g->w[i], g->h[i], 0, (g->c[i] == 4 ? GL_RGBA : GL_RGB), GL_UNSIGNED_BYTE, g->pixels[i]);
+		}
+		glTexParameteri(g->target, GL_TEXTURE_MIN_FILTER, g->filter);
+		glTexParameteri(g->target, GL_TEXTURE_MAG_FILTER, g->filter);
+		glTexParameteri(g->target, GL_TEXTURE_WRAP_S, g->wrap);
+		glTexParameteri(g->target, GL_TEXTURE_WRAP_T, g->wrap);
+		glTexParameteri(g->target, GL_TEXTURE_WRAP_R, g->wrap);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+	}
+	for (uint32_t i = 0; i < faces; i++)
+	{
+		stbi_image_free(g->pixels[i]);
+		g->pixels[i] = nullptr;
+	}
+	g->state = (failed ? GLOBAL_FAILED : GLOBAL_READY);
+	return (failed ? fallback : g->id);
+}
+
+/*
+ * Material normal map, the default one when the material has none.
+ */
+static GLuint
+material_normal(const struct material& m)
 {
-	uint32_t program;
-	uint32_t fragment;
-	uint32_t vertex;
+	const GLuint id = tex_get(m.normal_texture, 0);
+
+	return (id ? id : global_get(&gl.image_normal, gl.texture_flat));
+}
 
-	vertex = program_module_compile(GL_VERTEX_SHADER, vertex_file_path);
-	fragment = program_module_compile(GL_FRAGMENT_SHADER, fragment_file_path);
+/*
+ * GLSL 330 cannot give a block its binding point.
+ */
+static void
+program_block(GLuint program, const char* name, GLuint binding)
+{
+	const GLuint index = glGetUniformBlockIndex(program, name);
 
-	program = glCreateProgram();
-	glAttachShader(program, vertex);
-	glAttachShader(program, fragment);
-	glLinkProgram(program);
+	if (index != GL_INVALID_INDEX)
+	{
+		glUniformBlockBinding(program, index, binding);
+	}
+}
 
+/*
+ * Makes program the one drawn with for which, once it is linked.
+ */
+static void
+program_locate(GLuint program, int which)
+{
+	if (program == 0)
+	{
+		return;
+	}
 	if (which == 0)
 	{
-		gl.program.uniform.mvp = glGetUniformLocation(program, "mvp");
-		gl.program.uniform.eye = glGetUniformLocation(program, "eye");
-		gl.program.uniform.ambient = glGetUniformLocation(program, "ambient_in");
-		gl.program.uniform.specular = glGetUniformLocation(program, "specular_in");
-		gl.program.uniform.transparency = glGetUniformLocation(program, "transparency_in");
-		gl.program.uniform.diffuse = glGetUniformLocation(program, "diffuse_in");
-		gl.program.uniform.distant_light_dir = glGetUniformLocation(program, "distant_light_dir_in");
+		gl.program.id = program;
+		gl.program.uniform.material = glGetUniformLocation(program, "material_index");
 		gl.program.uniform.imgtexture = glGetUniformLocation(program, "imgtexture");
 		gl.program.uniform.normalmap = glGetUniformLocation(program, "normalmap");
 		gl.program.uniform.model = glGetUniformLocation(program, "model");
 		gl.program.uniform.parallaxmap = glGetUniformLocation(program, "parallaxmap");
+		gl.program.uniform.position_offset = glGetUniformLocation(program, "position_offset");
+		gl.program.uniform.position_scale = glGetUniformLocation(program, "position_scale");
+		program_block(program, "frame_block", BLOCK_FRAME);
+		program_block(program, "material_block", BLOCK_MATERIAL);
 	}
 	else if (which == 1)
 	{
+		gl.program_sky.id = program;
 		gl.program_sky.uniform.mvp = glGetUniformLocation(program, "mvp");
 		gl.program_sky.uniform.gamma = glGetUniformLocation(program, "gamma");
 	}
 	else if (which == 2)
 	{
+		gl.program_bb.id = program;
 		gl.program_bb.uniform.mvp = glGetUniformLocation(program, "mvp");
 		gl.program_bb.uniform.screenwh = glGetUniformLocation(program, "screenwh");
 	}
 	else if (which == 3)
 	{
+		gl.program_line.id = program;
 		gl.program_line.uniform.mvp = glGetUniformLocation(program, "mvp");
 		gl.program_line.uniform.colour = glGetUniformLocation(program, "colour");
 	}
 	else if (which == 4)
 	{
+		gl.program_display.id = program;
 		gl.program_display.uniform.imgtexture = glGetUniformLocation(program, "imgtexture");
 		gl.program_display.uniform.display_resolution = glGetUniformLocation(program, "display_resolution");
 	}
+}
 
-	glDetachShader(program, vertex);
-	glDetachShader(program, fragment);
-	glDeleteShader(vertex);
-	glDeleteShader(fragment);
-
-	return program;
+/*
+ * Takes in the programs the driver finished since the last frame. Until
+ * then the scene draws with the fallback program and the other passes are
+ * skipped.
+ */
+static void
+program_poll(void)
+{
+	if (gl.program.fallback && program_get(gl.program.handle) != 0)
+	{
+		program_locate(program_get(gl.program.handle), 0);
+		state_forget(program_get(gl.program.fallback));
+		program_release(gl.program.fallback);
+		gl.program.fallback = 0;
+	}
+	if (gl.program_sky.id == 0)
+	{
+		program_locate(program_get(gl.program_sky.handle), 1);
+	}
+	if (gl.program_bb.id == 0)
+	{
+		program_locate(program_get(gl.program_bb.handle), 2);
+	}
+	if (gl.program_line.id == 0)
+	{
+		program_locate(program_get(gl.program_line.handle), 3);
+	}
+	if (gl.program_display.id == 0)
+	{
+		program_locate(program_get(gl.program_display.handle), 4);
+	}
 }
 
-int
-r_newscene(enum scene scene)
+static int
+scene_view_of(enum scene scene, struct scene_view* view, std::string* mesh_path, std::string* material_path)
 {
 	const std::string workdir = "rom/part/";
-	std::string line, active_material = "none", active_name = "none";
-	std::ifstream fp, fm;
-	std::vector<glm::vec3> buffer_vertex;
-	std::vector<glm::vec2> buffer_uv;
-	std::vector<glm::vec3> buffer_normal;
-	std::vector<float> buffer_final;
-	std::vector<float> buffer_line_final;
-	uint32_t vfirst = 0;
-
-	gl.trackball.aspect = def_w / def_h;
+
+	view->pitch = -3.14159f / 8.0f;
+	view->yaw = -3.14159f / 4.0f;
 	switch (scene)
 	{
 	default:
 		return 1;
-		break;
 	case scene::SCENE_VOID:
-		gl.trackball.pitch = -3.14159f / 8.0f;
-		gl.trackball.yaw = -3.14159f / 4.0f;
-		gl.trackball.focus = { 0.0f, 0.0f, 0.0f };
-		gl.trackball.radius = 8.0f;
-		gl.billboard[0].position = { 0.0f, 0.0f, 0.0f };
+		view->focus = { 0.0f, 0.0f, 0.0f };
+		view->radius = 8.0f;
+		view->sun = { 0.0f, 0.0f, 0.0f };
 		break;
 	case scene::SCENE_ROOM:
-		fp.open(workdir + "parts.obj");
-		fm.open(workdir + "parts.mtl");
-		gl.trackball.pitch = -3.14159f / 8.0f;
-		gl.trackball.yaw = -3.14159f / 4.0f;
-		gl.trackball.focus = { 20.0f, 6.0f, 4.0f };
-		gl.trackball.radius = 64.0f;
-		gl.billboard[0].position = { 6.0f, -14.0f, 11.0f };
+		*mesh_path = workdir + "parts.obj";
+		*material_path = workdir + "parts.mtl";
+		view->focus = { 20.0f, 6.0f, 4.0f };
+		view->radius = 64.0f;
+		view->sun = { 6.0f, -14.0f, 11.0f };
 		break;
 	case scene::SCENE_PRIMITIVES:
-		fp.open(workdir + "parts2.obj");
-		fm.open(workdir + "parts2.mtl");
-		gl.trackball.pitch = -3.14159f / 8.0f;
-		gl.trackball.yaw = -3.14159f / 4.0f;
-		gl.trackball.focus = { 0.0f, 0.0f, 0.0f };
-		gl.trackball.radius = 16.0f;
-		gl.billboard[0].position = { 4.0f, -10.0f, 2.0f };
+		*mesh_path = workdir + "parts2.obj";
+		*material_path = workdir + "parts2.mtl";
+		view->focus = { 0.0f, 0.0f, 0.0f };
+		view->radius = 16.0f;
+		view->sun = { 4.0f, -10.0f, 2.0f };
 		break;
 	case scene::SCENE_3:
-		fp.open(workdir + "parts3.obj");
-		fm.open(workdir + "parts3.mtl");
-		gl.trackball.pitch = -3.14159f / 8.0f;
-		gl.trackball.yaw = -3.14159f / 4.0f;
-		gl.trackball.focus = { 0.0f, 0.0f, 0.0f };
-		gl.trackball.radius = 16.0f;
-		gl.billboard[0].position = { 4.0f, -10.0f, 2.0f };
+		*mesh_path = workdir + "parts3.obj";
+		*material_path = workdir + "parts3.mtl";
+		view->focus = { 0.0f, 0.0f, 0.0f };
+		view->radius = 16.0f;
+		view->sun = { 4.0f, -10.0f, 2.0f };
 		break;
 	}
+	return 0;
+}
+
+static void
+scene_view_apply(const struct scene_view& view)
+{
+	gl.trackball.aspect = (float)def_w / def_h;
+	gl.trackball.pitch = view.pitch;
+	gl.trackball.yaw = view.yaw;
+	gl.trackball.focus = view.focus;
+	gl.trackball.radius = view.radius;
+	gl.billboard[0].position = view.sun;
 	gl.billboard[0].facing = -gl.billboard[0].position;
 	gl.billboard[0].facing.y *= -1;
 	if (glm::length(gl.billboard[0].facing) > 0.0f)
@@ -375,326 +743,596 @@ r_newscene(enum scene scene)
 		gl.billboard[0].facing = glm::vec3(0.0f, 0.0f, 1.0f);
 	}
 	cam_trackball(&gl.trackball);
+}
 
-	if (gl.scene == scene && scene != scene::SCENE_VOID)
+static void
+scene_release(struct scene_data* d)
+{
+	for (const struct material& m : d->material)
 	{
-		return 0;
+		tex_release(m.diffuse_texture);
+		tex_release(m.normal_texture);
+	}
+	if (d->vbo)
+	{
+		glDeleteBuffers(1, &d->vbo);
+		glDeleteBuffers(1, &d->ibo);
+		glDeleteVertexArrays(1, &d->vao);
+	}
+	if (d->vbo_line)
+	{
+		glDeleteBuffers(1, &d->vbo_line);
+		glDeleteVertexArrays(1, &d->vao_line);
 	}
+	*d = { };
+}
+
+/*
+ * Index of the named material, a default one is added for names the material
+ * library does not have.
+ */
+static uint32_t
+scene_material(struct scene_stage* s, const std::string& name)
+{
+	auto it = s->material_index.find(name);
 
-	for (auto& m : gl.material)
+	if (it != s->material_index.end())
 	{
-		if (m.second.diffuse_texture)
-		{
-			glDeleteTextures(1, &m.second.diffuse_texture);
-			glDeleteTextures(1, &m.second.normal_texture);
-		}
+		return it->second;
+	}
+	s->material_index[name] = (uint32_t)s->data.material.size();
+	s->data.material.push_back({});
+	s->data.material_name.push_back(name);
+	return (uint32_t)s->data.material.size() - 1;
+}
+
+/*
+ * Name is kept in the side table, anything drawing needs from it is resolved
+ * here.
+ */
+static void
+scene_object(struct scene_stage* s, struct object* o, const std::string& material, const std::string& name)
+{
+	o->material = scene_material(s, material);
+	o->name = (uint32_t)s->data.object_name.size();
+	o->parallax = (name == "PAR");
+	if (name == "pCube1") { o->explicit_position = { -5.0f, 0.0f, 0.0f }; }
+	else if (name == "pCylinder1") { o->explicit_position = { 5.0f, 0.0f, 0.0f }; }
+	else if (name == "pCone1") { o->explicit_position = { 0.0f, 0.0f, -5.0f }; }
+	else if (name == "pTorus1") { o->explicit_position = { 0.0f, 0.0f, 5.0f }; }
+	s->data.object_name.push_back(name);
+}
+
+/*
+ * Groups the opaque objects by material and parallax map. Indices stay
+ * relative to each object's first vertex, so one batch is drawn with
+ * glMultiDrawElementsBaseVertex. With packed vertices the objects take the
+ * bounds of their batch, which the packing then quantizes them to.
+ */
+static void
+scene_batch(struct scene_stage* s, const float* vertex_data, uint32_t index_size)
+{
+	std::map<uint32_t, uint32_t> key; /* Material and parallax map to batch. */
+	std::vector<glm::vec3> lo, hi;
+
+	s->data.batch.clear();
+	for (const struct object& o : s->data.object)
+	{
+		key.emplace((o.material << 1) | (uint32_t)o.parallax, 0);
+	}
+	for (auto& k : key)
+	{
+		k.second = (uint32_t)s->data.batch.size();
+		s->data.batch.push_back({});
+		s->data.batch.back().material = k.first >> 1;
+		s->data.batch.back().parallax = (int)(k.first & 1);
+	}
+	lo.assign(s->data.batch.size(), glm::vec3(FLT_MAX));
+	hi.assign(s->data.batch.size(), glm::vec3(-FLT_MAX));
+
+	for (const struct object& o : s->data.object)
+	{
+		const uint32_t i = key[(o.material << 1) | (uint32_t)o.parallax];
+		struct batch& b = s->data.batch[i];
+		glm::vec3 olo, ohi;
+
+		b.count.push_back((GLsizei)o.icount);
+		b.offset.push_back((const void*)((size_t)index_size * o.ifirst));
+		b.basevertex.push_back((GLint)o.vfirst);
+		mesh_bounds(vertex_data + (size_t)o.vfirst * MESH_VERTEX_FLOATS, o.vcount, &olo, &ohi);
+		lo[i] = glm::min(lo[i], olo);
+		hi[i] = glm::max(hi[i], ohi);
+	}
+	for (uint32_t i = 0; i < s->data.batch.size(); i++)
+	{
+		s->data.batch[i].position_offset = lo[i];
+		s->data.batch[i].position_scale = glm::max(hi[i] - lo[i], glm::vec3(0.0f));
+	}
+	for (struct object& o : s->data.object)
+	{
+		const struct batch& b = s->data.batch[key[(o.material << 1) | (uint32_t)o.parallax]];
+
+		o.position_offset = b.position_offset;
+		o.position_scale = b.position_scale;
 	}
-	gl.material.clear();
-	gl.object.clear();
-	gl.object_transparent.clear();
+	std::cout << "static batches: " << s->data.object.size() << " objects in " << s->data.batch.size() << " draws" << std::endl;
+}
+
+/*
+ * Runs on a worker: material library, mesh data from the cache when it is up
+ * to date, packing and bounds. Nothing here touches GL or the textures.
+ */
+static void
+scene_parse(struct scene_stage* s)
+{
+	const float* vertex_data = nullptr;
+	uint32_t index_size = 2;
+	uint32_t index_count = 0;
 
-	/* Material library. */
-	if (fm.is_open())
+	if (!s->material_path.empty() && mesh_load_mtl(&s->mtl, s->material_path.c_str()) == 0)
 	{
-		while (std::getline(fm, line))
+		for (const struct mesh_material& mm : s->mtl)
 		{
-			if (line.empty())
-			{
-				continue;
-			}
+			struct material& m = s->data.material[scene_material(s, mm.name)];
+
+			std::cout << "mat: " << mm.name << std::endl;
+			m.ambient = mm.ambient;
+			m.diffuse = mm.diffuse;
+			m.specular = mm.specular;
+			m.transparency = mm.transparency;
+		}
+		/* Hashed here so tex_load does not on the render thread. */
+		job_parallel((uint32_t)s->mtl.size(), [s](uint32_t i)
+		{
+			const struct mesh_material& mm = s->mtl[i];
 
-			if (line.substr(0, 6) == "newmtl")
+			if (!mm.diffuse_path.empty())
 			{
-				active_material = line.substr(7);
-				std::cout << "mat: " << active_material << std::endl;
+				tex_prepare(("rom/part/" + mm.diffuse_path).c_str());
 			}
-			else if (line.substr(0, 2) == "Ka")
+			if (!mm.normal_path.empty())
 			{
-				std::istringstream iss(line.substr(3));
-
-				iss >> gl.material[active_material].ambient.r >> gl.material[active_material].ambient.g >> gl.material[active_material].ambient.b;
+				tex_prepare(("rom/part/" + mm.normal_path).c_str());
 			}
-			else if (line.substr(0, 2) == "Kd")
-			{
-				std::istringstream iss(line.substr(3));
+		});
+	}
 
-				iss >> gl.material[active_material].diffuse.r >> gl.material[active_material].diffuse.g >> gl.material[active_material].diffuse.b;
-			}
-			else if (line.substr(0, 2) == "Ks")
-			{
-				std::istringstream iss(line.substr(3));
+	if (!s->mesh_path.empty())
+	{
+		const std::string cache_path = s->mesh_path + ".mesh";
 
-				iss >> gl.material[active_material].specular.r >> gl.material[active_material].specular.g >> gl.material[active_material].specular.b;
+		if (mesh_cache_open(&s->cache, cache_path.c_str(), s->mesh_path.c_str()) == 0)
+		{
+			for (uint32_t i = 0; i < s->cache.group_count; i++)
+			{
+				s->data.object.push_back({});
+				s->data.object.back().vfirst = s->cache.group[i].vfirst;
+				s->data.object.back().vcount = s->cache.group[i].vcount;
+				s->data.object.back().ifirst = s->cache.group[i].ifirst;
+				s->data.object.back().icount = s->cache.group[i].icount;
+				scene_object(s, &s->data.object.back(), s->cache.string + s->cache.group[i].material, s->cache.string + s->cache.group[i].name);
 			}
-			else if (line.substr(0, 2) == "Ns")
+			vertex_data = s->cache.vertex;
+			s->vertex_count = s->cache.vertex_count;
+			s->index_data = (const uint8_t*)s->cache.index;
+			index_count = s->cache.index_count;
+			index_size = s->cache.index_size;
+		}
+		else
+		{
+			if (mesh_load_obj(&s->mesh, s->mesh_path.c_str()))
 			{
-				std::istringstream iss(line.substr(3));
-
-				iss >> gl.material[active_material].specular.a;
-				gl.material[active_material].specular.a *= 1;
+				s->state.store(STAGE_FAILED, std::memory_order_release);
+				return;
 			}
-			else if (line.substr(0, 2) == "Tf")
+			if (mesh_cache_write(&s->mesh, cache_path.c_str(), s->mesh_path.c_str()))
 			{
-				float unused, unused2;
-				std::istringstream iss(line.substr(3));
-
-				iss >> gl.material[active_material].transparency >> unused >> unused2;
-				gl.material[active_material].transparency = 1.0f - gl.material[active_material].transparency;
+				std::cout << "mesh cache issue " << cache_path << std::endl;
 			}
-			else if (line.substr(0, 6) == "map_Kd")
+			for (const struct mesh_group& g : s->mesh.group)
 			{
-				std::istringstream iss(line.substr(7));
-				std::string path;
-				unsigned char* data = nullptr;
-				GLuint texture;
-				int w = 0, h = 0, c = 0;
+				s->data.object.push_back({});
+				s->data.object.back().vfirst = g.vfirst;
+				s->data.object.back().vcount = g.vcount;
+				s->data.object.back().ifirst = g.ifirst;
+				s->data.object.back().icount = g.icount;
+				scene_object(s, &s->data.object.back(), g.material, g.name);
+			}
+			vertex_data = s->mesh.vertex.data();
+			s->vertex_count = (uint32_t)(s->mesh.vertex.size() / MESH_VERTEX_FLOATS);
+			index_size = mesh_index_pack(&s->mesh, &s->index);
+			s->index_data = s->index.data();
+			index_count = (uint32_t)s->mesh.index.size();
+		}
+	}
+	s->data.index_type = (index_size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT);
+	s->index_bytes = (size_t)index_size * index_count;
 
-				iss >> path;
+	/* Bounds and texture coordinate extent. */
+	job_parallel((uint32_t)s->data.object.size(), [s, vertex_data](uint32_t i)
+	{
+		struct object& o = s->data.object[i];
+		glm::vec3 lo = glm::vec3(FLT_MAX), hi = glm::vec3(-FLT_MAX);
+		glm::vec2 uv_lo = glm::vec2(FLT_MAX), uv_hi = glm::vec2(-FLT_MAX);
 
-				/* Example -mm_0.7181_0.214286_NameOfFile.jpg */
-				if (path[0] == '-')
-				{
-					size_t i1 = path.find('_');
-					size_t i2 = path.find('_', i1 + 1);
-					size_t i3 = path.find('_', i2 + 1);
-
-					path = path.substr(i3 + 1);
-				}
-
-				data = stbi_load((workdir + path).c_str(), &w, &h, &c, 0);
-				glGenTextures(1, &texture);
-				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, texture);
-				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-				glGenerateMipmap(GL_TEXTURE_2D);
-				stbi_image_free(data);
-				gl.material[active_material].diffuse_texture = texture;
-				gl.material[active_material].diffuse = { 1.0f, 1.0f, 1.0f };
-			}
-			else if (line.substr(0, 4) == "bump")
+		for (uint32_t v = 0; v < o.vcount; v++)
+		{
+			const float* p = vertex_data + (size_t)(o.vfirst + v) * MESH_VERTEX_FLOATS;
+
+			lo = glm::min(lo, glm::vec3(p[0], p[1], p[2]));
+			hi = glm::max(hi, glm::vec3(p[0], p[1], p[2]));
+			uv_lo = glm::min(uv_lo, glm::vec2(p[3], p[4]));
+			uv_hi = glm::max(uv_hi, glm::vec2(p[3], p[4]));
+		}
+		if (o.vcount > 0)
+		{
+			o.center = (lo + hi) * 0.5f;
+			o.radius = glm::length(hi - lo) * 0.5f;
+			o.uv_span = std::max(std::max(uv_hi.x - uv_lo.x, uv_hi.y - uv_lo.y), 1.0f / 4096.0f);
+		}
+	});
+
+	{
+		auto it = s->data.object.begin();
+
+		while (it != s->data.object.end())
+		{
+			if (s->data.material[it->material].transparency > 0.0f)
 			{
-				/* bump  -bm 1 WoodFlooring14_NRM_6K.jpg*/
-				std::string path = line.substr(12);
-				unsigned char* data = nullptr;
-				GLuint texture;
-				int w, h, c;
-
-				data = stbi_load((workdir + path).c_str(), &w, &h, &c, 0);
-				glGenTextures(1, &texture);
-				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, texture);
-				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-				glGenerateMipmap(GL_TEXTURE_2D);
-				stbi_image_free(data);
-				gl.material[active_material].normal_texture = texture;
+				s->data.object_transparent.push_back(*it);
+				it = s->data.object.erase(it);
 			}
 			else
 			{
-				std::cout << "noop " << line << std::endl;
+				it++;
 			}
 		}
 	}
+	if (settings.batch_static)
+	{
+		scene_batch(s, vertex_data, index_size);
+	}
 
-	/* Mesh data. */
-	if (fp.is_open())
+	/* Compact vertices, every object quantized to its own bounds or those of its batch. */
+	if (settings.vertex_packed)
 	{
-		while (std::getline(fp, line))
+		s->packed.resize(s->vertex_count);
+		job_parallel((uint32_t)s->data.object.size(), [s, vertex_data](uint32_t i)
 		{
-			if (line.empty() || line[0] == '#')
-			{
-				continue;
-			}
+			struct object& o = s->data.object[i];
 
-			if (line[0] == 'g')
+			if (settings.batch_static)
 			{
-				std::string name = line.substr(2);
-
-				if (name != "default")
-				{
-					/*
-					if (!gl.object.empty() && gl.object.at(gl.object.size() - 1).material == "")
-					{
-						std::cout << "total vertices: " << gl.object.at(gl.object.size() - 1).vcount << std::endl;
-					}
-					*/
-					gl.object.push_back({});
-					gl.object.at(gl.object.size() - 1).vfirst = vfirst;
-					gl.object.at(gl.object.size() - 1).vcount = 0;
-					gl.object.at(gl.object.size() - 1).name = name;
-					std::cout << name << std::endl;
-				}
+				mesh_pack_bounds(s->packed.data() + o.vfirst, vertex_data + (size_t)o.vfirst * MESH_VERTEX_FLOATS, o.vcount, o.position_offset, o.position_scale);
 			}
-			else if (line[0] == 'v' && line[1] == ' ')
+			else
 			{
-				char c;
-				float x, y, z;
-
-				std::istringstream iss(line);
-				if (!(iss >> c >> x >> y >> z))
-				{
-					return 1;
-				}
-				y *= -1;
-
-				buffer_vertex.push_back(glm::vec3(x, y, z));
+				mesh_pack(s->packed.data() + o.vfirst, vertex_data + (size_t)o.vfirst * MESH_VERTEX_FLOATS, o.vcount, &o.position_offset, &o.position_scale);
 			}
-			else if (line[0] == 'v' && line[1] == 't')
-			{
-				char c1, c2;
-				float u, v;
+		});
+		for (struct object& o : s->data.object_transparent)
+		{
+			mesh_pack(s->packed.data() + o.vfirst, vertex_data + (size_t)o.vfirst * MESH_VERTEX_FLOATS, o.vcount, &o.position_offset, &o.position_scale);
+		}
+		s->vertex_data = (const uint8_t*)s->packed.data();
+		s->vertex_bytes = sizeof(struct mesh_vertex_packed) * s->vertex_count;
+	}
+	else
+	{
+		s->vertex_data = (const uint8_t*)vertex_data;
+		s->vertex_bytes = sizeof(float) * MESH_VERTEX_FLOATS * s->vertex_count;
+	}
+	s->state.store(STAGE_PARSED, std::memory_order_release);
+}
 
-				std::istringstream iss(line);
-				if (!(iss >> c1 >> c2 >> u >> v))
-				{
-					return 1;
-				}
-				buffer_uv.push_back(glm::vec2(u, v));
-			}
-			else if (line[0] == 'v' && line[1] == 'n')
-			{
-				char c1, c2;
-				float x, y, z;
+/*
+ * Creates the buffers and requests the textures once the worker is done.
+ */
+static void
+scene_stage_buffers(struct scene_stage* s)
+{
+	struct scene_view view;
+	std::string mesh_path, material_path;
+	glm::vec3 facing;
+	float line[6];
 
-				std::istringstream iss(line);
-				if (!(iss >> c1 >> c2 >> x >> y >> z))
-				{
-					return 1;
-				}
-				buffer_normal.push_back(glm::vec3(x, y, z));
-			}
-			else if (line[0] == 'f')
-			{
-				char c;
-				int i, v[3], t[3], n[3];
+	for (const struct mesh_material& mm : s->mtl)
+	{
+		struct material& m = s->data.material[s->material_index[mm.name]];
 
-				std::istringstream iss(line);
-				if (!(iss >> c >> v[0] >> c >> t[0] >> c >> n[0] >> v[1] >> c >> t[1] >> c >> n[1] >> v[2] >> c >> t[2] >> c >> n[2]))
-				{
-					return 1;
-				}
-
-				/* Tangent and bitagent. */
-				glm::vec3 pos1 = buffer_vertex[v[0] - 1];
-				glm::vec3 pos2 = buffer_vertex[v[1] - 1];
-				glm::vec3 pos3 = buffer_vertex[v[2] - 1];
-				glm::vec2 uv1 = buffer_uv[t[0] - 1];
-				glm::vec2 uv2 = buffer_uv[t[1] - 1];
-				glm::vec2 uv3 = buffer_uv[t[2] - 1];
-
-				glm::vec3 edge1 = pos2 - pos1;
-				glm::vec3 edge2 = pos3 - pos1;
-				glm::vec2 deltaUV1 = uv2 - uv1;
-				glm::vec2 deltaUV2 = uv3 - uv1;
-				float f = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y);
-
-				glm::vec3 tangent1;
-				glm::vec3 bitangent1;
-
-				tangent1.x = f * (deltaUV2.y * edge1.x - deltaUV1.y * edge2.x);
-				tangent1.y = f * (deltaUV2.y * edge1.y - deltaUV1.y * edge2.y);
-				tangent1.z = f * (deltaUV2.y * edge1.z - deltaUV1.y * edge2.z);
-
-				bitangent1.x = f * (-deltaUV2.x * edge1.x + deltaUV1.x * edge2.x);
-				bitangent1.y = f * (-deltaUV2.x * edge1.y + deltaUV1.x * edge2.y);
-				bitangent1.z = f * (-deltaUV2.x * edge1.z + deltaUV1.x * edge2.z);
-
-				for (i = 0; i < 3; i++)
-				{
-					buffer_final.push_back(buffer_vertex[v[i] - 1].x);
-					buffer_final.push_back(buffer_vertex[v[i] - 1].y);
-					buffer_final.push_back(buffer_vertex[v[i] - 1].z);
-					buffer_final.push_back(buffer_uv[t[i] - 1].x);
-					buffer_final.push_back(buffer_uv[t[i] - 1].y);
-					buffer_final.push_back(buffer_normal[n[i] - 1].x);
-					buffer_final.push_back(buffer_normal[n[i] - 1].y);
-					buffer_final.push_back(buffer_normal[n[i] - 1].z);
-					buffer_final.push_back(tangent1.x);
-					buffer_final.push_back(tangent1.y);
-					buffer_final.push_back(tangent1.z);
-					buffer_final.push_back(bitangent1.x);
-					buffer_final.push_back(bitangent1.y);
-					buffer_final.push_back(bitangent1.z);
-				}
-
-				vfirst += 3;
-				gl.object.at(gl.object.size() - 1).vcount += 3;
-			}
-			else if (line[0] == 'u')
-			{
-				gl.object.at(gl.object.size() - 1).material = line.substr(7);
-			}
-			else
-			{
-				std::cout << "noop " << line << std::endl;
-			}
+		if (!mm.diffuse_path.empty())
+		{
+			m.diffuse_texture = tex_load(("rom/part/" + mm.diffuse_path).c_str(), TEX_COLOUR, settings.texture_scale);
+		}
+		if (!mm.normal_path.empty())
+		{
+			m.normal_texture = tex_load(("rom/part/" + mm.normal_path).c_str(), TEX_NORMAL, settings.texture_scale);
 		}
 	}
 
+	glGenBuffers(1, &s->data.vbo);
+	glGenBuffers(1, &s->data.ibo);
+	glGenVertexArrays(1, &s->data.vao);
+	glBindVertexArray(s->data.vao);
+	glBindBuffer(GL_ARRAY_BUFFER, s->data.vbo);
+	glBufferData(GL_ARRAY_BUFFER, s->vertex_bytes, nullptr, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, s->data.ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, s->index_bytes, nullptr, GL_STATIC_DRAW);
+	if (settings.vertex_packed)
+	{
+		glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(struct mesh_vertex_packed), (void*)offsetof(struct mesh_vertex_packed, position));
+		glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(struct mesh_vertex_packed), (void*)offsetof(struct mesh_vertex_packed, uv));
+		glVertexAttribPointer(2, 2, GL_SHORT, GL_TRUE, sizeof(struct mesh_vertex_packed), (void*)offsetof(struct mesh_vertex_packed, normal));
+		glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, sizeof(struct mesh_vertex_packed), (void*)offsetof(struct mesh_vertex_packed, tangent));
+		glEnableVertexAttribArray(0);
+		glEnableVertexAttribArray(1);
+		glEnableVertexAttribArray(2);
+		glEnableVertexAttribArray(3);
+	}
+	else
 	{
-		auto it = gl.object.begin();
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, (3 + 2 + 3 + 3 + 3) * sizeof(float), (void*)(sizeof(float) * (0)));
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, (3 + 2 + 3 + 3 + 3) * sizeof(float), (void*)(sizeof(float) * (3)));
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, (3 + 2 + 3 + 3 + 3) * sizeof(float), (void*)(sizeof(float) * (3 + 2)));
+		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, (3 + 2 + 3 + 3 + 3) * sizeof(float), (void*)(sizeof(float) * (3 + 2 + 3)));
+		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, (3 + 2 + 3 + 3 + 3) * sizeof(float), (void*)(sizeof(float) * (3 + 2 + 3 + 3)));
+		glEnableVertexAttribArray(0);
+		glEnableVertexAttribArray(1);
+		glEnableVertexAttribArray(2);
+		glEnableVertexAttribArray(3);
+		glEnableVertexAttribArray(4);
+	}
+	std::cout << "vertex buffer: " << s->vertex_count << " vertices, " << s->vertex_bytes / 1024 << " KB " << (settings.vertex_packed ? "packed" : "float") << std::endl;
+
+	/* Sun direction line. */
+	scene_view_of(s->data.scene, &view, &mesh_path, &material_path);
+	facing = -view.sun;
+	facing.y *= -1;
+	facing = (glm::length(facing) > 0.0f ? glm::normalize(facing) : glm::vec3(0.0f, 0.0f, 1.0f));
+	line[0] = view.sun.x;
+	line[1] = view.sun.y;
+	line[2] = view.sun.z;
+	line[3] = view.sun.x + facing.x * 2;
+	line[4] = view.sun.y - facing.y * 2;
+	line[5] = view.sun.z + facing.z * 2;
+	glGenBuffers(1, &s->data.vbo_line);
+	glGenVertexArrays(1, &s->data.vao_line);
+	glBindVertexArray(s->data.vao_line);
+	glBindBuffer(GL_ARRAY_BUFFER, s->data.vbo_line);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(line), line, GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, (3) * sizeof(float), (void*)(sizeof(float) * 0));
+	glEnableVertexAttribArray(0);
+}
 
-		while (it != gl.object.end())
+/*
+ * Fills the vertex buffer, then the index buffer, until the deadline.
+ * Returns 1 when everything is uploaded.
+ */
+static int
+scene_stage_upload(struct scene_stage* s, std::chrono::steady_clock::time_point deadline)
+{
+	const size_t slice = 4 * 1024 * 1024;
+
+	glBindVertexArray(s->data.vao);
+	glBindBuffer(GL_ARRAY_BUFFER, s->data.vbo);
+	while (s->uploaded < s->vertex_bytes + s->index_bytes && std::chrono::steady_clock::now() < deadline)
+	{
+		if (s->uploaded < s->vertex_bytes)
 		{
-			if (gl.material[it->material].transparency > 0.0f)
-			{
-				gl.object_transparent.push_back(*it);
-				it = gl.object.erase(it);
-			}
-			else
+			const size_t size = std::min(slice, s->vertex_bytes - s->uploaded);
+
+			glBufferSubData(GL_ARRAY_BUFFER, s->uploaded, size, s->vertex_data + s->uploaded);
+			s->uploaded += size;
+		}
+		else
+		{
+			const size_t at = s->uploaded - s->vertex_bytes;
+			const size_t size = std::min(slice, s->index_bytes - at);
+
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, at, size, s->index_data + at);
+			s->uploaded += size;
+		}
+	}
+	if (s->uploaded < s->vertex_bytes + s->index_bytes)
+	{
+		return 0;
+	}
+
+	/* The CPU copies are not needed any more. */
+	mesh_cache_close(&s->cache);
+	s->mesh = { };
+	s->index = { };
+	s->packed = { };
+	s->vertex_data = nullptr;
+	s->index_data = nullptr;
+	return 1;
+}
+
+static void
+scene_stage_begin(enum scene scene)
+{
+	std::shared_ptr<struct scene_stage> s = std::make_shared<struct scene_stage>();
+	struct scene_view view;
+
+	s->data.scene = scene;
+	s->state = STAGE_PARSING;
+	s->begin = std::chrono::steady_clock::now();
+	scene_view_of(scene, &view, &s->mesh_path, &s->material_path);
+	gl.stage = s;
+	job_push([s]()
+	{
+		scene_parse(s.get());
+	});
+}
+
+static void
+scene_stage_drop(void)
+{
+	mesh_cache_close(&gl.stage->cache);
+	scene_release(&gl.stage->data);
+	gl.stage.reset();
+}
+
+/*
+ * Advances the staged scene by one frame and swaps it in when it is
+ * complete: geometry uploaded until deadline and every texture resident at
+ * some level.
+ */
+static void
+scene_tick(std::chrono::steady_clock::time_point deadline)
+{
+	struct scene_stage* s;
+	int state;
+
+	if (!gl.stage)
+	{
+		if (gl.requested != gl.active.scene)
+		{
+			scene_stage_begin(gl.requested);
+		}
+		return;
+	}
+	s = gl.stage.get();
+	state = s->state.load(std::memory_order_acquire);
+	if (state == STAGE_PARSING)
+	{
+		return;
+	}
+	if (state == STAGE_FAILED)
+	{
+		std::cout << "scene load issue " << s->mesh_path << std::endl;
+		if (gl.requested == s->data.scene)
+		{
+			gl.requested = gl.active.scene;
+		}
+		scene_stage_drop();
+		return;
+	}
+	if (s->data.scene != gl.requested)
+	{
+		scene_stage_drop();
+		return;
+	}
+
+	switch (state)
+	{
+	default:
+		break;
+	case STAGE_PARSED:
+		scene_stage_buffers(s);
+		s->state = STAGE_UPLOADING;
+		/* Fall through. */
+	case STAGE_UPLOADING:
+		if (scene_stage_upload(s, deadline))
+		{
+			s->state = STAGE_TEXTURES;
+		}
+		break;
+	case STAGE_TEXTURES:
+		for (const struct material& m : s->data.material)
+		{
+			if (!tex_ready(m.diffuse_texture) || !tex_ready(m.normal_texture))
 			{
-				it++;
+				return;
 			}
 		}
+		{
+			struct scene_view view;
+			std::string mesh_path, material_path;
+
+			std::swap(gl.active, s->data);
+			scene_view_of(gl.active.scene, &view, &mesh_path, &material_path);
+			scene_view_apply(view);
+			std::cout << "scene " << (int)gl.active.scene << " ready after "
+				<< std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - s->begin).count() << " ms" << std::endl;
+			gl.report = 1;
+		}
+		scene_stage_drop();
+		break;
 	}
+}
 
-	if (gl.vbo)
+/*
+ * Requests a scene. It is loaded in the background and replaces the active
+ * scene once complete, selecting the active scene again resets its camera.
+ */
+int
+r_newscene(enum scene scene)
+{
+	struct scene_view view;
+	std::string mesh_path, material_path;
+
+	if (scene_view_of(scene, &view, &mesh_path, &material_path))
 	{
-		glDeleteBuffers(1, &gl.vbo);
-		glDeleteVertexArrays(1, &gl.vao);
-		glDeleteBuffers(1, &gl.vbo_line);
-		glDeleteVertexArrays(1, &gl.vao_line);
+		return 1;
 	}
-	glGenBuffers(1, &gl.vbo);
-	glGenVertexArrays(1, &gl.vao);
-	glBindVertexArray(gl.vao);
-	glBindBuffer(GL_ARRAY_BUFFER, gl.vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * buffer_final.size(), buffer_final.data(), GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, (3 + 2 + 3 + 3 + 3) * sizeof(float), (void*)(sizeof(float) * (0)));
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, (3 + 2 + 3 + 3 + 3) * sizeof(float), (void*)(sizeof(float) * (3)));
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, (3 + 2 + 3 + 3 + 3) * sizeof(float), (void*)(sizeof(float) * (3 + 2)));
-	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, (3 + 2 + 3 + 3 + 3) * sizeof(float), (void*)(sizeof(float) * (3 + 2 + 3)));
-	glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, (3 + 2 + 3 + 3 + 3) * sizeof(float), (void*)(sizeof(float) * (3 + 2 + 3 + 3)));
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glEnableVertexAttribArray(2);
-	glEnableVertexAttribArray(3);
-	glEnableVertexAttribArray(4);
-
-	buffer_line_final.push_back(gl.billboard[0].position.x);
-	buffer_line_final.push_back(gl.billboard[0].position.y);
-	buffer_line_final.push_back(gl.billboard[0].position.z);
-	buffer_line_final.push_back(gl.billboard[0].position.x+ gl.billboard[0].facing.x * 2);
-	buffer_line_final.push_back(gl.billboard[0].position.y - gl.billboard[0].facing.y * 2);
-	buffer_line_final.push_back(gl.billboard[0].position.z + gl.billboard[0].facing.z * 2);
-	glGenBuffers(1, &gl.vbo_line);
-	glGenVertexArrays(1, &gl.vao_line);
-	glBindVertexArray(gl.vao_line);
-	glBindBuffer(GL_ARRAY_BUFFER, gl.vbo_line);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * buffer_line_final.size(), buffer_line_final.data(), GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, (3) * sizeof(float), (void*)(sizeof(float) * 0));
-	glEnableVertexAttribArray(0);
+	gl.requested = scene;
+	if (scene == gl.active.scene)
+	{
+		scene_view_apply(view);
+	}
+	return 0;
+}
 
-	gl.scene = scene;
+/*
+ * (Re)allocates the storage of the offscreen colour texture and depth
+ * buffer at def_w x def_h, the GL objects stay the same.
+ */
+static void
+display_allocate(void)
+{
+	glBindTexture(GL_TEXTURE_2D, gl.texture_fb_display);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, def_w, def_h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindRenderbuffer(GL_RENDERBUFFER, gl.rbo);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, def_w, def_h);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+}
 
-	return 0;
+/*
+ * Called from the window system on every size change. Only records the
+ * size, a drag produces many of these.
+ */
+void
+r_resize(int w, int h)
+{
+	gl.window.w = w;
+	gl.window.h = h;
+	gl.window.pending = 1;
+	gl.window.last = std::chrono::steady_clock::now();
+	if (gl.fb_display == 0)
+	{
+		def_w = std::max(w, 1);
+		def_h = std::max(h, 1);
+		gl.window.pending = 0;
+	}
+}
+
+/*
+ * Resizes the framebuffer attachments once the window size has not changed
+ * for DISPLAY_SETTLE_MS. Until then the old image is stretched to the
+ * window. Minimized windows keep their framebuffer.
+ */
+static void
+display_tick(void)
+{
+	if (!gl.window.pending || gl.window.w <= 0 || gl.window.h <= 0
+	|| std::chrono::steady_clock::now() - gl.window.last < std::chrono::milliseconds(DISPLAY_SETTLE_MS))
+	{
+		return;
+	}
+	gl.window.pending = 0;
+	if (gl.window.w == def_w && gl.window.h == def_h)
+	{
+		return;
+	}
+	def_w = gl.window.w;
+	def_h = gl.window.h;
+	display_allocate();
+	gl.trackball.aspect = (float)def_w / def_h;
+	cam_trackball(&gl.trackball);
+	std::cout << "display " << def_w << "x" << def_h << std::endl;
 }
 
 int
@@ -765,9 +1403,9 @@ r_glbegin(void)
 		-1.0f, 1.0f, 0.0f, 1.0f, 1.0f,
 		-1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
 	};
+	static const uint8_t flat[3 * 2 * 2] = { 0x80, 0x80, 0xff, 0x80, 0x80, 0xff, 0x80, 0x80, 0xff, 0x80, 0x80, 0xff };
+	static const uint8_t grey[3 * 2 * 2] = { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 };
 	struct billboard billboard;
-	unsigned char* data = nullptr;
-	int w = 0, h = 0, c = 0;
 
 	glClearColor(1.0f, 0.0f, 0.0f, 1.0f);
 	glEnable(GL_CULL_FACE);
@@ -780,38 +1418,45 @@ r_glbegin(void)
 	// Framebuffer display
 	//
 	glGenFramebuffers(1, &gl.fb_display);
-	glBindFramebuffer(GL_FRAMEBUFFER, gl.fb_display);
-
 	glGenTextures(1, &gl.texture_fb_display);
-	glBindTexture(GL_TEXTURE_2D, gl.texture_fb_display);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, def_w, def_h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gl.texture_fb_display, 0);
-
 	glGenRenderbuffers(1, &gl.rbo);
-	glBindRenderbuffer(GL_RENDERBUFFER, gl.rbo);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, def_w, def_h);
-	glBindRenderbuffer(GL_RENDERBUFFER, 0);
-
+	display_allocate();
+	glBindFramebuffer(GL_FRAMEBUFFER, gl.fb_display);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gl.texture_fb_display, 0);
 	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, gl.rbo);
-
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-	unsigned int texture;
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
-
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, def_w, def_h, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+	{
+		const std::string defines = std::string(settings.vertex_packed ? "#define VERTEX_PACKED\n" : "") + "#define MATERIAL_MAX " + std::to_string(MATERIAL_MAX) + "\n";
+		const uint32_t fallback = program_submit("fallback", defines.c_str());
+
+		/* Submitted together so the driver can compile them side by side. */
+		gl.program.id = 0;
+		gl.program_sky.id = 0;
+		gl.program_bb.id = 0;
+		gl.program_line.id = 0;
+		gl.program_display.id = 0;
+		gl.program.handle = program_submit("default", defines.c_str());
+		gl.program_sky.handle = program_submit("skybox", "");
+		gl.program_bb.handle = program_submit("billboard", "");
+		gl.program_line.handle = program_submit("line", "");
+		gl.program_display.handle = program_submit("ppfx", "");
+		program_locate(program_wait(fallback), 0);
+		gl.program.fallback = fallback;
+		program_poll();
+	}
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	{
+		GLint block_size = 0;
 
-	gl.program.id = program_new("rom/program/default_vert.glsl", "rom/program/default_frag.glsl", 0);
-	gl.program_sky.id = program_new("rom/program/skybox_vert.glsl", "rom/program/skybox_frag.glsl", 1);
-	gl.program_bb.id = program_new("rom/program/billboard_vert.glsl", "rom/program/billboard_frag.glsl", 2);
-	gl.program_line.id = program_new("rom/program/line_vert.glsl", "rom/program/line_frag.glsl", 3);
-	gl.program_display.id = program_new("rom/program/ppfx_vert.glsl", "rom/program/ppfx_frag.glsl", 4);
+		/* At least 16 KB, a page of materials takes 12. */
+		glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &block_size);
+		gl.block_failed = ((size_t)block_size < MATERIAL_MAX * sizeof(struct material_block));
+		if (gl.block_failed)
+		{
+			std::cout << "material_block needs " << MATERIAL_MAX * sizeof(struct material_block) << " bytes, uniform blocks are limited to " << block_size << ", the scene is not drawn." << std::endl;
+		}
+	}
 
 	glGenTextures(1, &gl.texture_white);
 	glActiveTexture(GL_TEXTURE0);
@@ -822,80 +1467,25 @@ r_glbegin(void)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-	data = stbi_load("rom/normal_default.jpg", &w, &h, &c, 0);
-	glGenTextures(1, &gl.texture_normal);
-	glBindTexture(GL_TEXTURE_2D, gl.texture_normal);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-	stbi_image_free(data);
-	data = stbi_load("rom/scene1.jpg", &w, &h, &c, 0);
-	glGenTextures(1, &gl.texture_scene1);
-	glBindTexture(GL_TEXTURE_2D, gl.texture_scene1);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-	stbi_image_free(data);
-	data = stbi_load("rom/scene2.jpg", &w, &h, &c, 0);
-	glGenTextures(1, &gl.texture_scene2);
-	glBindTexture(GL_TEXTURE_2D, gl.texture_scene2);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-	stbi_image_free(data);
-	data = stbi_load("rom/Cobblestone16_DISP_6K.jpg", &w, &h, &c, 0);
-	glGenTextures(1, &gl.texture_displace_test);
-	glBindTexture(GL_TEXTURE_2D, gl.texture_displace_test);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-	stbi_image_free(data);
-
-	billboard.position = { 0.0f, 0.0f, 0.0f };
-	data = stbi_load("rom/sun.png", &w, &h, &c, 0);
-	if (!data) { std::cout << "rom/sun issue\n"; }
-	glGenTextures(1, &billboard.texture);
-	glBindTexture(GL_TEXTURE_2D, billboard.texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	stbi_image_free(data);
-	gl.billboard.clear();
-	gl.billboard.push_back(billboard);
+	glGenTextures(1, &gl.texture_flat);
+	glBindTexture(GL_TEXTURE_2D, gl.texture_flat);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 2, 2, 0, GL_RGB, GL_UNSIGNED_BYTE, flat);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-	glGenTextures(1, &gl.texture_cubemap2);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, gl.texture_cubemap2);
+	glGenTextures(1, &gl.texture_grey);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, gl.texture_grey);
 	for (uint32_t i = 0; i < 6; i++)
 	{
-		static const char* cubemap_picture[] = { "rom/cbm_left.jpg", "rom/cbm_right.jpg", "rom/cbm_top.jpg", "rom/cbm_bottom.jpg", "rom/cbm_back.jpg", "rom/cbm_front.jpg", };
-
-		data = stbi_load(cubemap_picture[i], &w, &h, &c, 0);
-		if (!data)
-		{
-			std::cout << "cubemap issue\n";
-		}
-		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-		stbi_image_free(data);
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, 2, 2, 0, GL_RGB, GL_UNSIGNED_BYTE, grey);
 	}
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-	glGenTextures(1, &gl.texture_cubemap);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, gl.texture_cubemap);
-	for (uint32_t i = 0; i < 6; i++)
-	{
-		static const char* cubemap_picture[] = { "rom/cbb_right.jpg", "rom/cbb_left.jpg", "rom/cbb_top.jpg", "rom/cbm_bottom.jpg", "rom/cbb_front.jpg", "rom/cbb_back.jpg", };
 
-		data = stbi_load(cubemap_picture[i], &w, &h, &c, 0);
-		if (!data)
-		{
-			std::cout << "cubemap issue\n";
-		}
-		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-		stbi_image_free(data);
-	}
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	billboard.position = { 0.0f, 0.0f, 0.0f };
+	billboard.image = &gl.image_sun;
+	gl.billboard.clear();
+	gl.billboard.push_back(billboard);
 
 	// SKY
 	glGenBuffers(1, &gl.vbo_sky);
@@ -928,7 +1518,11 @@ r_glbegin(void)
 	glEnableVertexAttribArray(0);
 	glEnableVertexAttribArray(1);
 
-	glViewport(0, 0, def_w, def_h);
+	if (gl.window.w == 0)
+	{
+		gl.window.w = def_w;
+		gl.window.h = def_h;
+	}
 
 	{
 		static int firstr = 1;
@@ -941,178 +1535,249 @@ r_glbegin(void)
 		else
 		{
 
-			return r_newscene(gl.scene);
+			return r_newscene(gl.active.scene);
 		}
 	}
 
 }
 
-void
-r_gltick(struct r_tick tick)
+static uint32_t
+block_page_size(void)
 {
-	const float radius_factor = powf(gl.trackball.radius / 10.0f, 1.225f);
-	uint32_t i;
+	const uint32_t align = ring_align();
 
-	if (tick.cursor.wheel != 0)
+	return (MATERIAL_MAX * sizeof(struct material_block) + align - 1) / align * align;
+}
+
+static uint32_t
+block_material_offset(void)
+{
+	const uint32_t align = ring_align();
+
+	return (sizeof(struct frame_block) + align - 1) / align * align;
+}
+
+/*
+ * Writes camera, light and every material of the scene into this frame's
+ * region of the ring, growing it for a scene with more materials. Materials
+ * do not change, they are written again because the region is. 1 when the
+ * blocks could not be written and bound, the scene passes are then skipped.
+ */
+static int
+block_upload(void)
+{
+	const uint32_t pages = std::max<uint32_t>(1, ((uint32_t)gl.active.material.size() + MATERIAL_MAX - 1) / MATERIAL_MAX);
+	const uint32_t size = block_material_offset() + pages * block_page_size();
+	struct frame_block frame;
+	uint8_t* region;
+
+	if (gl.block_failed)
 	{
-		int sign = (tick.cursor.wheel > 0 ? -1 : 1);
-		float d = sign * abs(radius_factor * tick.cursor.wheel) / 100.0f;
+		return 1;
+	}
+	if (gl.ring.size < size)
+	{
+		if (gl.ring_failed == size)
+		{
+			return 1;
+		}
+		ring_release(&gl.ring);
+		if (ring_create(&gl.ring, size))
+		{
+			gl.ring_failed = size;
+			return 1;
+		}
+	}
 
-		gl.trackball.radius += d;
-		cam_trackball(&gl.trackball);
+	frame.viewproj = gl.trackball.viewproj;
+	if (gl.active.scene != scene::SCENE_ROOM)
+	{
+		frame.eye = glm::vec4(gl.trackball.position.x, -gl.trackball.position.y, gl.trackball.position.z, 1.0f);
 	}
+	else
+	{
+		frame.eye = glm::vec4(gl.trackball.position, 1.0f);
+	}
+	frame.distant_light_dir = glm::vec4(gl.billboard[0].position.x, -gl.billboard[0].position.y, gl.billboard[0].position.z, 0.0f);
 
-	switch (tick.cursor.mode)
+	region = ring_map(&gl.ring);
+	if (region == nullptr)
 	{
-	default:
-	case CURSOR_MODE_STAGNANT:
-		break;
-	case CURSOR_MODE_ORBIT:
-		gl.trackball.yaw -= tick.cursor.dx / 100.0f;
-		gl.trackball.pitch += tick.cursor.dy / 100.0f;
-		cam_trackball(&gl.trackball);
-		break;
-	case CURSOR_MODE_PAN:
-		gl.trackball.focus[0] -= radius_factor / 5.0f * gl.trackball.right[0] * (tick.cursor.dx / 10.0f) - radius_factor / 5.0f * gl.trackball.up[0] * (tick.cursor.dy / 10.0f);
-		gl.trackball.focus[1] += radius_factor / 5.0f * gl.trackball.up[1] * (tick.cursor.dy / 10.0f);
-		gl.trackball.focus[2] -= radius_factor / 5.0f * gl.trackball.right[2] * (tick.cursor.dx / 10.0f) - radius_factor / 5.0f * gl.trackball.up[2] * (tick.cursor.dy / 10.0f);
-		cam_trackball(&gl.trackball);
-		break;
+		return 1;
 	}
+	memcpy(region, &frame, sizeof(frame));
+	for (size_t i = 0; i < gl.active.material.size(); i++)
+	{
+		const struct material& m = gl.active.material[i];
+		struct material_block b;
 
-	glBindFramebuffer(GL_FRAMEBUFFER, gl.fb_display);
+		b.ambient = glm::vec4(m.ambient, m.transparency);
+		b.diffuse = glm::vec4(m.diffuse, 0.0f);
+		b.specular = m.specular;
+		memcpy(region + block_material_offset() + (i / MATERIAL_MAX) * block_page_size() + (i % MATERIAL_MAX) * sizeof(b), &b, sizeof(b));
+	}
+	ring_unmap(&gl.ring);
 
-	glClearColor(1.0f, 0.0f, 0.0f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	ring_bind(&gl.ring, BLOCK_FRAME, 0, sizeof(struct frame_block));
+	ring_bind(&gl.ring, BLOCK_MATERIAL, block_material_offset(), MATERIAL_MAX * sizeof(struct material_block));
+	gl.material_page = 0;
+	return 0;
+}
 
-	glDepthMask(GL_FALSE);
-	glFrontFace(GL_CW);
-	glUseProgram(gl.program_sky.id);
-	glUniformMatrix4fv(gl.program_sky.uniform.mvp, 1, GL_FALSE, glm::value_ptr(gl.trackball.viewproj_sky));
-	glBindVertexArray(gl.vao_sky);
-	switch (gl.scene)
+/*
+ * Selects material for the next draw, binding its page first when it is in
+ * another one.
+ */
+static void
+block_material(uint32_t material)
+{
+	const uint32_t page = material / MATERIAL_MAX;
+
+	if (page != gl.material_page)
 	{
-	default:
-	case scene::SCENE_ROOM:
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, gl.texture_cubemap);
-		glUniform1f(gl.program_sky.uniform.gamma, 1.0f);
-		break;
-	case scene::SCENE_PRIMITIVES:
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, gl.texture_cubemap2);
-		glUniform1f(gl.program_sky.uniform.gamma, 0.9f);
-		break;
+		ring_bind(&gl.ring, BLOCK_MATERIAL, block_material_offset() + page * block_page_size(), MATERIAL_MAX * sizeof(struct material_block));
+		gl.material_page = page;
 	}
-	glDrawArrays(GL_TRIANGLES, 0, 36);
-	glDepthMask(GL_TRUE);
-	glFrontFace(GL_CCW);
+	state_uniform1i(gl.program.uniform.material, material % MATERIAL_MAX);
+}
 
-	//
-	// Billboard.
-	//
-	glUseProgram(gl.program_bb.id);
-	glBindVertexArray(gl.vao_bb);
-	glUniform2fv(gl.program_bb.uniform.screenwh, 1, glm::value_ptr(glm::vec2(def_w, def_h)));
-	for (i = 0; i < gl.billboard.size(); i++)
+/*
+ * Indices are relative to the object's first vertex. Packed vertices are
+ * dequantized with the object's bounds.
+ */
+static void
+object_draw(const struct object& o)
+{
+	const size_t index_size = (gl.active.index_type == GL_UNSIGNED_SHORT ? 2 : 4);
+
+	if (settings.vertex_packed)
 	{
-		glm::mat4 mvp;
-		glm::mat4 model = glm::identity<glm::mat4>();
+		state_uniform3fv(gl.program.uniform.position_offset, glm::value_ptr(o.position_offset));
+		state_uniform3fv(gl.program.uniform.position_scale, glm::value_ptr(o.position_scale));
+	}
 
-		model = glm::translate(model, gl.billboard[i].position);
-		model = glm::rotate(model, gl.trackball.yaw + 3.1415f, glm::vec3(0.0f, -1.0f, 0.0f));
-		model = glm::rotate(model, gl.trackball.pitch, glm::vec3(1.0f, 0.0f, 0.0f));
-		mvp = gl.trackball.viewproj * model;
+	glDrawElementsBaseVertex(GL_TRIANGLES, o.icount, gl.active.index_type, (void*)(index_size * o.ifirst), o.vfirst);
+}
+
+/*
+ * One draw call for every object of the batch.
+ */
+static void
+batch_draw(const struct batch& b)
+{
+	if (settings.vertex_packed)
+	{
+		state_uniform3fv(gl.program.uniform.position_offset, glm::value_ptr(b.position_offset));
+		state_uniform3fv(gl.program.uniform.position_scale, glm::value_ptr(b.position_scale));
+	}
 
-		glUniformMatrix4fv(gl.program_bb.uniform.mvp, 1, GL_FALSE, glm::value_ptr(mvp));
+	glMultiDrawElementsBaseVertex(GL_TRIANGLES, b.count.data(), gl.active.index_type, b.offset.data(), (GLsizei)b.count.size(), b.basevertex.data());
+}
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, gl.billboard[i].texture);
-		glDrawArrays(GL_TRIANGLES, 0, 6);
+/*
+ * Tells the texture streaming how large the object's textures appear. The
+ * bounding sphere radius is projected along the camera's up vector, a
+ * texture needs as many texels across as the object covers pixels divided by
+ * how often the texture repeats over it. Objects behind the camera report
+ * nothing.
+ */
+static void
+object_stream(const struct object& o)
+{
+	const struct material& m = gl.active.material[o.material];
+	const glm::vec3 center = o.center + o.explicit_position;
+	const glm::vec4 clip = gl.trackball.viewproj * glm::vec4(center, 1.0f);
+	float pixels;
+
+	if (clip.w < -o.radius)
+	{
+		return;
 	}
+	if (clip.w > o.radius)
+	{
+		const glm::vec4 edge = gl.trackball.viewproj * glm::vec4(center + gl.trackball.up * o.radius, 1.0f);
 
-	//
-	// Lines.
-	//
-	glUseProgram(gl.program_line.id);
-	glBindVertexArray(gl.vao_line);
-	glUniformMatrix4fv(gl.program_line.uniform.mvp, 1, GL_FALSE, glm::value_ptr(gl.trackball.viewproj));
-	for (i = 0; i < gl.billboard.size(); i++)
+		pixels = std::min(fabsf(edge.y / edge.w - clip.y / clip.w) * def_h, (float)std::max(def_w, def_h));
+	}
+	else
 	{
-		glUniform3fv(gl.program_line.uniform.colour, 1, glm::value_ptr(glm::vec3(1.0f, 0.0f, 0.0f)));
-		glDrawArrays(GL_LINES, 0, 2);
+		pixels = (float)std::max(def_w, def_h);
 	}
+	tex_want(m.diffuse_texture, pixels / o.uv_span, pixels * pixels);
+	tex_want(m.normal_texture, pixels / o.uv_span, pixels * pixels);
+}
 
-	//
-	// Regular object.
-	//
-	glUseProgram(gl.program.id);
-	glUniformMatrix4fv(gl.program.uniform.mvp, 1, GL_FALSE, glm::value_ptr(gl.trackball.viewproj));
-	if (gl.scene != scene::SCENE_ROOM)
+/*
+ * Opaque objects grouped by material and parallax map, each group front to
+ * back so early depth testing rejects fragments before the parallax and
+ * normal mapping of default_frag.glsl runs for them.
+ */
+static void
+object_queue(void)
+{
+	gl.queue.item.clear();
+	if (!gl.active.batch.empty())
 	{
-		glUniform3fv(gl.program.uniform.eye, 1, glm::value_ptr(glm::vec3(gl.trackball.position.x, -gl.trackball.position.y, gl.trackball.position.z)));
+		/* Drawn by batch. */
+		return;
 	}
-	else
+	for (uint32_t i = 0; i < gl.active.object.size(); i++)
 	{
-		glUniform3fv(gl.program.uniform.eye, 1, glm::value_ptr(gl.trackball.position));
+		const struct object& o = gl.active.object[i];
+		const glm::vec4 clip = gl.trackball.viewproj * glm::vec4(o.center + o.explicit_position, 1.0f);
+
+		gl.queue.item.push_back({ queue_key(0, gl.program.id, (o.material << 1) | o.parallax, clip.w - o.radius), i });
 	}
-	glUniform3fv(gl.program.uniform.distant_light_dir, 1, glm::value_ptr(glm::vec3(gl.billboard[0].position.x, -gl.billboard[0].position.y, gl.billboard[0].position.z)));
-	glUniformMatrix4fv(gl.program.uniform.model, 1, GL_FALSE, glm::value_ptr(glm::identity<glm::mat4>()));
-	glUniform1i(gl.program.uniform.imgtexture, 0);
-	glUniform1i(gl.program.uniform.normalmap, 1);
-	glUniform1i(gl.program.uniform.parallaxmap, 2);
-	glActiveTexture(GL_TEXTURE2);
-	//glBindTexture(GL_TEXTURE_2D, gl.texture_white);
+	queue_sort(&gl.queue);
+}
 
-	glBindVertexArray(gl.vao);
-	for (i = 0; i < gl.object.size(); i++)
+/*
+ * Opaque objects, then transparent ones back to front, reading camera and
+ * materials from the blocks block_upload wrote.
+ */
+static void
+scene_draw(void)
+{
+	uint32_t i;
+
+	//
+	// Regular object.
+	//
+	state_program(gl.program.id);
+	state_uniform_matrix4fv(gl.program.uniform.model, glm::value_ptr(glm::identity<glm::mat4>()));
+	state_uniform1i(gl.program.uniform.imgtexture, 0);
+	state_uniform1i(gl.program.uniform.normalmap, 1);
+	state_uniform1i(gl.program.uniform.parallaxmap, 2);
+
+	state_vao(gl.active.vao);
+	for (const struct batch& b : gl.active.batch)
 	{
-		const struct material& m = gl.material.find(gl.object.at(i).material)->second;
+		const struct material& m = gl.active.material[b.material];
 
-		glUniform3fv(gl.program.uniform.ambient, 1, glm::value_ptr(m.ambient));
-		glUniform4fv(gl.program.uniform.specular, 1, glm::value_ptr(m.specular));
-		glUniform3fv(gl.program.uniform.diffuse, 1, glm::value_ptr(m.diffuse));
-		glUniform1f(gl.program.uniform.transparency, m.transparency);
+		block_material(b.material);
 
-		if (m.diffuse_texture)
-		{
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, m.diffuse_texture);
-		}
-		else
-		{
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, gl.texture_white);
-		}
-		if (m.normal_texture)
-		{
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, m.normal_texture);
-		}
-		else
-		{
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, gl.texture_normal);
-		}
+		state_texture(0, GL_TEXTURE_2D, tex_get(m.diffuse_texture, gl.texture_white));
+		state_texture(1, GL_TEXTURE_2D, material_normal(m));
+		state_texture(2, GL_TEXTURE_2D, (b.parallax ? global_get(&gl.image_displace, 0) : 0));
 
-		if (gl.object.at(i).name == "PAR")
-		{
-			//std::cout << "PAR TEST" << std::endl;
-			glActiveTexture(GL_TEXTURE2);
-			glBindTexture(GL_TEXTURE_2D, gl.texture_displace_test);
-		}
+		batch_draw(b);
+	}
+	object_queue();
+	for (const struct queue_item& it : gl.queue.item)
+	{
+		const struct object& o = gl.active.object[it.payload];
+		const struct material& m = gl.active.material[o.material];
+
+		block_material(o.material);
+
+		state_texture(0, GL_TEXTURE_2D, tex_get(m.diffuse_texture, gl.texture_white));
+		state_texture(1, GL_TEXTURE_2D, material_normal(m));
+		state_texture(2, GL_TEXTURE_2D, (o.parallax ? global_get(&gl.image_displace, 0) : 0));
 
-		glDrawArrays(GL_TRIANGLES, gl.object[i].vfirst, gl.object[i].vcount);
+		object_draw(o);
 	}
 
 	// SCENE 2
-	for (i = 0; i < gl.object_transparent.size(); i++)
-	{
-		if (gl.object_transparent[i].name == "pCube1") { gl.object_transparent[i].explicit_position = { -5.0f, 0.0f, 0.0f }; }
-		else if (gl.object_transparent[i].name == "pCylinder1") { gl.object_transparent[i].explicit_position = { 5.0f, 0.0f, 0.0f }; }
-		else if (gl.object_transparent[i].name == "pCone1") { gl.object_transparent[i].explicit_position = { 0.0f, 0.0f, -5.0f }; }
-		else if (gl.object_transparent[i].name == "pTorus1") { gl.object_transparent[i].explicit_position = { 0.0f, 0.0f, 5.0f }; }
-	}
 	{
 		struct object_compare
 		{
@@ -1125,110 +1790,219 @@ r_gltick(struct r_tick tick)
 			}
 		};
 
-		std::sort(gl.object_transparent.begin(), gl.object_transparent.end(), object_compare());
+		std::sort(gl.active.object_transparent.begin(), gl.active.object_transparent.end(), object_compare());
 	}
 
 	//
 	// Transparent (pass 1).
 	//
-	glFrontFace(GL_CW);
-	for (i = 0; i < gl.object_transparent.size(); i++)
+	state_front_face(GL_CW);
+	for (i = 0; i < gl.active.object_transparent.size(); i++)
 	{
-		const struct material& m = gl.material.find(gl.object_transparent.at(i).material)->second;
-		glm::mat4 mvp;
+		const struct material& m = gl.active.material[gl.active.object_transparent[i].material];
 		glm::mat4 model = glm::identity<glm::mat4>();
-		model = glm::translate(model, gl.object_transparent[i].explicit_position);
-		mvp = gl.trackball.viewproj * model;
+		model = glm::translate(model, gl.active.object_transparent[i].explicit_position);
 
-		glUniformMatrix4fv(gl.program.uniform.model, 1, GL_FALSE, glm::value_ptr(model));
-		glUniformMatrix4fv(gl.program.uniform.mvp, 1, GL_FALSE, glm::value_ptr(mvp));
-		glUniform3fv(gl.program.uniform.diffuse, 1, glm::value_ptr(m.diffuse));
-		glUniform3fv(gl.program.uniform.ambient, 1, glm::value_ptr(m.ambient));
-		glUniform4fv(gl.program.uniform.specular, 1, glm::value_ptr(m.specular));
-		glUniform1f(gl.program.uniform.transparency, m.transparency);
+		state_uniform_matrix4fv(gl.program.uniform.model, glm::value_ptr(model));
+		block_material(gl.active.object_transparent[i].material);
 
-		if (m.diffuse_texture)
-		{
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, m.diffuse_texture);
-		}
-		else
-		{
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, gl.texture_white);
-		}
-		if (m.normal_texture)
-		{
+		state_texture(0, GL_TEXTURE_2D, tex_get(m.diffuse_texture, gl.texture_white));
+		state_texture(1, GL_TEXTURE_2D, material_normal(m));
 
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, m.normal_texture);
-		}
-		else
-		{
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, gl.texture_normal);
-		}
-
-		glDrawArrays(GL_TRIANGLES, gl.object_transparent[i].vfirst, gl.object_transparent[i].vcount);
+		object_draw(gl.active.object_transparent[i]);
 	}
 	// Transparent (pass 2).
-	glFrontFace(GL_CCW);
-	for (i = 0; i < gl.object_transparent.size(); i++)
+	state_front_face(GL_CCW);
+	for (i = 0; i < gl.active.object_transparent.size(); i++)
 	{
-		const struct material& m = gl.material.find(gl.object_transparent.at(i).material)->second;
-		glm::mat4 mvp;
+		const struct material& m = gl.active.material[gl.active.object_transparent[i].material];
 		glm::mat4 model = glm::identity<glm::mat4>();
-		model = glm::translate(model, gl.object_transparent[i].explicit_position);
-		mvp = gl.trackball.viewproj * model;
+		model = glm::translate(model, gl.active.object_transparent[i].explicit_position);
 
-		glUniformMatrix4fv(gl.program.uniform.model, 1, GL_FALSE, glm::value_ptr(model));
-		glUniformMatrix4fv(gl.program.uniform.mvp, 1, GL_FALSE, glm::value_ptr(mvp));
-		glUniform3fv(gl.program.uniform.ambient, 1, glm::value_ptr(m.ambient));
-		glUniform3fv(gl.program.uniform.diffuse, 1, glm::value_ptr(m.diffuse));
-		glUniform4fv(gl.program.uniform.specular, 1, glm::value_ptr(m.specular));
-		glUniform1f(gl.program.uniform.transparency, m.transparency);
+		state_uniform_matrix4fv(gl.program.uniform.model, glm::value_ptr(model));
+		block_material(gl.active.object_transparent[i].material);
 
-		if (m.diffuse_texture)
-		{
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, m.diffuse_texture);
-		}
-		else
+		state_texture(0, GL_TEXTURE_2D, tex_get(m.diffuse_texture, gl.texture_white));
+		state_texture(1, GL_TEXTURE_2D, material_normal(m));
+
+		object_draw(gl.active.object_transparent[i]);
+	}
+}
+
+void
+r_gltick(struct r_tick tick)
+{
+	const float radius_factor = powf(gl.trackball.radius / 10.0f, 1.225f);
+	std::chrono::steady_clock::time_point deadline;
+	uint32_t i;
+
+	if (tick.cursor.wheel != 0)
+	{
+		int sign = (tick.cursor.wheel > 0 ? -1 : 1);
+		float d = sign * abs(radius_factor * tick.cursor.wheel) / 100.0f;
+
+		gl.trackball.radius += d;
+		cam_trackball(&gl.trackball);
+	}
+
+	switch (tick.cursor.mode)
+	{
+	default:
+	case CURSOR_MODE_STAGNANT:
+		break;
+	case CURSOR_MODE_ORBIT:
+		gl.trackball.yaw -= tick.cursor.dx / 100.0f;
+		gl.trackball.pitch += tick.cursor.dy / 100.0f;
+		cam_trackball(&gl.trackball);
+		break;
+	case CURSOR_MODE_PAN:
+		gl.trackball.focus[0] -= radius_factor / 5.0f * gl.trackball.right[0] * (tick.cursor.dx / 10.0f) - radius_factor / 5.0f * gl.trackball.up[0] * (tick.cursor.dy / 10.0f);
+		gl.trackball.focus[1] += radius_factor / 5.0f * gl.trackball.up[1] * (tick.cursor.dy / 10.0f);
+		gl.trackball.focus[2] -= radius_factor / 5.0f * gl.trackball.right[2] * (tick.cursor.dx / 10.0f) - radius_factor / 5.0f * gl.trackball.up[2] * (tick.cursor.dy / 10.0f);
+		cam_trackball(&gl.trackball);
+		break;
+	}
+
+	display_tick();
+	program_poll();
+
+	/* Loads the requested scene and uploads decoded textures, together within settings.upload_ms. */
+	deadline = std::chrono::steady_clock::now() + std::chrono::microseconds((int64_t)(settings.upload_ms * 1000.0f));
+	scene_tick(deadline);
+	for (const struct object& o : gl.active.object)
+	{
+		object_stream(o);
+	}
+	for (const struct object& o : gl.active.object_transparent)
+	{
+		object_stream(o);
+	}
+	tex_tick(deadline);
+	state_begin();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, gl.fb_display);
+	glViewport(0, 0, def_w, def_h);
+
+	glClearColor(1.0f, 0.0f, 0.0f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	if (gl.program_sky.id != 0)
+	{
+		state_depth_mask(GL_FALSE);
+		state_front_face(GL_CW);
+		state_program(gl.program_sky.id);
+		state_uniform_matrix4fv(gl.program_sky.uniform.mvp, glm::value_ptr(gl.trackball.viewproj_sky));
+		state_vao(gl.vao_sky);
+		switch (gl.active.scene)
 		{
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, gl.texture_white);
+		default:
+		case scene::SCENE_ROOM:
+			state_texture(0, GL_TEXTURE_CUBE_MAP, global_get(&gl.image_cubemap, gl.texture_grey));
+			state_uniform1f(gl.program_sky.uniform.gamma, 1.0f);
+			break;
+		case scene::SCENE_PRIMITIVES:
+			state_texture(0, GL_TEXTURE_CUBE_MAP, global_get(&gl.image_cubemap2, gl.texture_grey));
+			state_uniform1f(gl.program_sky.uniform.gamma, 0.9f);
+			break;
 		}
-		if (m.normal_texture)
+		glDrawArrays(GL_TRIANGLES, 0, 36);
+		state_depth_mask(GL_TRUE);
+		state_front_face(GL_CCW);
+	}
+
+	//
+	// Billboard.
+	//
+	if (gl.program_bb.id != 0)
+	{
+		state_program(gl.program_bb.id);
+		state_vao(gl.vao_bb);
+		state_uniform2fv(gl.program_bb.uniform.screenwh, glm::value_ptr(glm::vec2(def_w, def_h)));
+		for (i = 0; i < gl.billboard.size(); i++)
 		{
+			const GLuint texture = global_get(gl.billboard[i].image, 0);
+			glm::mat4 mvp;
+			glm::mat4 model = glm::identity<glm::mat4>();
 
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, m.normal_texture);
+			/* Nothing until the image is uploaded. */
+			if (texture == 0)
+			{
+				continue;
+			}
+			model = glm::translate(model, gl.billboard[i].position);
+			model = glm::rotate(model, gl.trackball.yaw + 3.1415f, glm::vec3(0.0f, -1.0f, 0.0f));
+			model = glm::rotate(model, gl.trackball.pitch, glm::vec3(1.0f, 0.0f, 0.0f));
+			mvp = gl.trackball.viewproj * model;
+
+			state_uniform_matrix4fv(gl.program_bb.uniform.mvp, glm::value_ptr(mvp));
+
+			state_texture(0, GL_TEXTURE_2D, texture);
+			glDrawArrays(GL_TRIANGLES, 0, 6);
 		}
-		else
+	}
+
+	//
+	// Lines.
+	//
+	if (gl.program_line.id != 0)
+	{
+		state_program(gl.program_line.id);
+		state_vao(gl.active.vao_line);
+		state_uniform_matrix4fv(gl.program_line.uniform.mvp, glm::value_ptr(gl.trackball.viewproj));
+		for (i = 0; gl.active.vao_line != 0 && i < gl.billboard.size(); i++)
 		{
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, gl.texture_normal);
+			state_uniform3fv(gl.program_line.uniform.colour, glm::value_ptr(glm::vec3(1.0f, 0.0f, 0.0f)));
+			glDrawArrays(GL_LINES, 0, 2);
 		}
+	}
 
-		glDrawArrays(GL_TRIANGLES, gl.object_transparent[i].vfirst, gl.object_transparent[i].vcount);
+	if (block_upload() == 0)
+	{
+		scene_draw();
+		ring_fence(&gl.ring);
 	}
 
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glUseProgram(gl.program_display.id);
-	glBindVertexArray(gl.vbo_ppfx);
+	glViewport(0, 0, gl.window.w, gl.window.h);
+	if (gl.program_display.id == 0)
+	{
+		/* Nothing reaches the window without it, and it is small. */
+		program_locate(program_wait(gl.program_display.handle), 4);
+	}
+	state_program(gl.program_display.id);
+	state_vao(gl.vao_ppfx);
 	glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glDisable(GL_DEPTH_TEST);
-	glActiveTexture(GL_TEXTURE0);
-	glUniform1i(gl.program_display.uniform.imgtexture, 0);
-	glUniform2fv(gl.program_display.uniform.display_resolution, 1, glm::value_ptr(glm::vec2(def_w, def_h)));
-	glBindTexture(GL_TEXTURE_2D, gl.texture_fb_display);
+	state_uniform1i(gl.program_display.uniform.imgtexture, 0);
+	state_uniform2fv(gl.program_display.uniform.display_resolution, glm::value_ptr(glm::vec2(gl.window.w, gl.window.h)));
+	state_texture(0, GL_TEXTURE_2D, gl.texture_fb_display);
 	glDrawArrays(GL_TRIANGLES, 0, 6);
 	glEnable(GL_DEPTH_TEST);
+
+	if (gl.report)
+	{
+		const struct state_count count = state_count();
+
+		std::cout << "state calls: " << count.issued << " issued, " << count.skipped << " skipped" << std::endl;
+		gl.report = 0;
+	}
 }
 
+/*
+ * Releases both scenes, after waiting for a worker still parsing one.
+ */
 void
 r_glexit(void)
 {
-	r_newscene(scene::SCENE_VOID);
+	if (gl.stage)
+	{
+		while (gl.stage->state.load(std::memory_order_acquire) == STAGE_PARSING)
+		{
+			std::this_thread::yield();
+		}
+		scene_stage_drop();
+	}
+	scene_release(&gl.active);
+	gl.requested = scene::SCENE_VOID;
 }
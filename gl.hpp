@@ -25,6 +25,7 @@ enum class scene: unsigned char
 };
 
 extern int r_glbegin(void);
+extern void r_resize(int w, int h);
 extern int r_newscene(enum scene scene);
 extern void r_gltick(struct r_tick tick);
 extern void r_glexit(void);
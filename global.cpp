@@ -1,7 +1,67 @@
 #include "global.hpp"
+#include <cstring>
+#include <thread>
 
 int def_w = 800;
 int def_h = 600;
+struct settings settings;
+
+void
+settings_parse(int argc, char** argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc)
+		{
+			settings.threads = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-vertex") == 0 && i + 1 < argc)
+		{
+			i++;
+			if (strcmp(argv[i], "packed") == 0 || strcmp(argv[i], "float") == 0)
+			{
+				settings.vertex_packed = (strcmp(argv[i], "packed") == 0);
+			}
+			else
+			{
+				std::cout << "-vertex takes packed or float, not " << argv[i] << std::endl;
+			}
+		}
+		else if (strcmp(argv[i], "-batch") == 0 && i + 1 < argc)
+		{
+			i++;
+			if (strcmp(argv[i], "static") == 0 || strcmp(argv[i], "object") == 0)
+			{
+				settings.batch_static = (strcmp(argv[i], "static") == 0);
+			}
+			else
+			{
+				std::cout << "-batch takes static or object, not " << argv[i] << std::endl;
+			}
+		}
+		else if (strcmp(argv[i], "-upload-ms") == 0 && i + 1 < argc)
+		{
+			settings.upload_ms = (float)atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-vram") == 0 && i + 1 < argc)
+		{
+			settings.vram_mb = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-texture-scale") == 0 && i + 1 < argc)
+		{
+			settings.texture_scale = atoi(argv[++i]);
+		}
+		else
+		{
+			std::cout << "unknown option " << argv[i] << std::endl;
+		}
+	}
+
+	if (settings.threads <= 0)
+	{
+		settings.threads = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+}
 
 #if defined(_WIN64) || defined(_WIN32)
 PFNGLCREATEPROGRAMPROC glCreateProgram = 0;
@@ -60,5 +120,22 @@ PFNGLGENRENDERBUFFERSPROC glGenRenderbuffers = 0;
 PFNGLBINDRENDERBUFFERPROC glBindRenderbuffer = 0;
 PFNGLFRAMEBUFFERRENDERBUFFERPROC glFramebufferRenderbuffer = 0;
 PFNGLRENDERBUFFERSTORAGEPROC glRenderbufferStorage = 0;
+PFNGLDRAWELEMENTSBASEVERTEXPROC glDrawElementsBaseVertex = 0;
+PFNGLMAPBUFFERRANGEPROC glMapBufferRange = 0;
+PFNGLFENCESYNCPROC glFenceSync = 0;
+PFNGLCLIENTWAITSYNCPROC glClientWaitSync = 0;
+PFNGLDELETESYNCPROC glDeleteSync = 0;
+PFNGLCOMPRESSEDTEXIMAGE2DPROC glCompressedTexImage2D = 0;
+PFNGLCOMPRESSEDTEXSUBIMAGE2DPROC glCompressedTexSubImage2D = 0;
+PFNGLGETPROGRAMBINARYPROC glGetProgramBinary = 0;
+PFNGLPROGRAMBINARYPROC glProgramBinary = 0;
+PFNGLPROGRAMPARAMETERIPROC glProgramParameteri = 0;
+PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glMaxShaderCompilerThreadsKHR = 0;
+PFNGLGETPROGRAMINFOLOGPROC glGetProgramInfoLog = 0;
+PFNGLBINDBUFFERRANGEPROC glBindBufferRange = 0;
+PFNGLGETUNIFORMBLOCKINDEXPROC glGetUniformBlockIndex = 0;
+PFNGLUNIFORMBLOCKBINDINGPROC glUniformBlockBinding = 0;
+PFNGLBUFFERSTORAGEPROC glBufferStorage = 0;
+PFNGLMULTIDRAWELEMENTSBASEVERTEXPROC glMultiDrawElementsBaseVertex = 0;
 #endif
 
@@ -3,6 +3,22 @@
 extern int def_w;
 extern int def_h;
 
+/*
+ * Command line settings, see settings_parse.
+ */
+struct settings
+{
+	int threads = 0; /* -threads N, threads used for parallel work, 1 keeps it on the calling thread */
+	int vertex_packed = 0; /* -vertex packed|float, layout of the scene vertex buffer */
+	int batch_static = 0; /* -batch static|object, opaque objects drawn per material instead of one by one */
+	float upload_ms = 4.0f; /* -upload-ms N, texture upload time per frame in milliseconds */
+	int vram_mb = 2048; /* -vram N, texture memory budget in MB, unused textures are released above it */
+	int texture_scale = 1; /* -texture-scale 1|2|4|8, material textures load at 1/N resolution */
+};
+
+extern struct settings settings;
+extern void settings_parse(int argc, char** argv);
+
 #include <iostream>
 #include <fstream>
 #include <stdint.h>
@@ -10,6 +26,7 @@ extern int def_h;
 #include <vector>
 #include <map>
 #include <algorithm>
+#include <chrono>
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtc/type_ptr.hpp"
@@ -50,6 +67,8 @@ typedef signed long long int GLintptr;
 typedef signed long      int GLsizeiptr;
 typedef signed long      int GLintptr;
 #endif
+typedef struct __GLsync* GLsync;
+typedef unsigned long long GLuint64;
 
 #define GL_ARRAY_BUFFER                   0x8892
 #define GL_STATIC_DRAW                    0x88E4
@@ -75,6 +94,42 @@ typedef signed long      int GLintptr;
 #define GL_RENDERBUFFER                   0x8D41
 #define GL_DEPTH_STENCIL_ATTACHMENT       0x821A
 #define GL_DEPTH24_STENCIL8               0x88F0
+#define GL_HALF_FLOAT                     0x140B
+#define GL_PIXEL_UNPACK_BUFFER            0x88EC
+#define GL_STREAM_DRAW                    0x88E0
+#define GL_MAP_WRITE_BIT                  0x0002
+#define GL_MAP_INVALIDATE_RANGE_BIT       0x0004
+#define GL_MAP_UNSYNCHRONIZED_BIT         0x0020
+#define GL_SYNC_GPU_COMMANDS_COMPLETE     0x9117
+#define GL_ALREADY_SIGNALED               0x911A
+#define GL_CONDITION_SATISFIED            0x911C
+#define GL_TIMEOUT_EXPIRED                0x911B
+#define GL_SYNC_FLUSH_COMMANDS_BIT        0x00000001
+#define GL_TEXTURE_BASE_LEVEL             0x813C
+#define GL_TEXTURE_MAX_LEVEL              0x813D
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT   0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT  0x83F3
+#define GL_COMPRESSED_RED_RGTC1           0x8DBB
+#define GL_COMPRESSED_RG_RGTC2            0x8DBD
+#define GL_COMPRESSED_RGBA_BPTC_UNORM     0x8E8C
+#define GL_RG                             0x8227
+#define GL_R8                             0x8229
+#define GL_RG8                            0x822B
+#define GL_TEXTURE_SWIZZLE_RGBA           0x8E46
+#define GL_LINK_STATUS                    0x8B82
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH         0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS     0x87FE
+#define GL_COMPILE_STATUS                 0x8B81
+#define GL_INFO_LOG_LENGTH                0x8B84
+#define GL_COMPLETION_STATUS_KHR          0x91B1
+#define GL_CURRENT_PROGRAM                0x8B8D
+#define GL_UNIFORM_BUFFER                 0x8A11
+#define GL_MAX_UNIFORM_BLOCK_SIZE         0x8A30
+#define GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT 0x8A34
+#define GL_INVALID_INDEX                  0xFFFFFFFFu
+#define GL_MAP_PERSISTENT_BIT             0x0040
+#define GL_MAP_COHERENT_BIT               0x0080
 
 /* OpenGL types. */
 typedef GLuint(*PFNGLCREATEPROGRAMPROC) (void);
@@ -148,6 +203,23 @@ typedef void (* PFNGLGENRENDERBUFFERSPROC) (GLsizei n, GLuint* renderbuffers);
 typedef void (* PFNGLBINDRENDERBUFFERPROC) (GLenum target, GLuint renderbuffer);
 typedef void (* PFNGLFRAMEBUFFERRENDERBUFFERPROC) (GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer);
 typedef void (* PFNGLRENDERBUFFERSTORAGEPROC) (GLenum target, GLenum internalformat, GLsizei width, GLsizei height);
+typedef void (* PFNGLDRAWELEMENTSBASEVERTEXPROC) (GLenum mode, GLsizei count, GLenum type, const void* indices, GLint basevertex);
+typedef void* (*PFNGLMAPBUFFERRANGEPROC) (GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+typedef GLsync (*PFNGLFENCESYNCPROC) (GLenum condition, GLbitfield flags);
+typedef GLenum (*PFNGLCLIENTWAITSYNCPROC) (GLsync sync, GLbitfield flags, GLuint64 timeout);
+typedef void (*PFNGLDELETESYNCPROC) (GLsync sync);
+typedef void (*PFNGLCOMPRESSEDTEXIMAGE2DPROC) (GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const void* data);
+typedef void (*PFNGLCOMPRESSEDTEXSUBIMAGE2DPROC) (GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLsizei imageSize, const void* data);
+typedef void (*PFNGLGETPROGRAMBINARYPROC) (GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (*PFNGLPROGRAMBINARYPROC) (GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (*PFNGLPROGRAMPARAMETERIPROC) (GLuint program, GLenum pname, GLint value);
+typedef void (*PFNGLMAXSHADERCOMPILERTHREADSKHRPROC) (GLuint count);
+typedef void (*PFNGLGETPROGRAMINFOLOGPROC) (GLuint program, GLsizei bufSize, GLsizei* length, char* infoLog);
+typedef void (*PFNGLBINDBUFFERRANGEPROC) (GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+typedef GLuint (*PFNGLGETUNIFORMBLOCKINDEXPROC) (GLuint program, const char* uniformBlockName);
+typedef void (*PFNGLUNIFORMBLOCKBINDINGPROC) (GLuint program, GLuint uniformBlockIndex, GLuint uniformBlockBinding);
+typedef void (*PFNGLBUFFERSTORAGEPROC) (GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+typedef void (*PFNGLMULTIDRAWELEMENTSBASEVERTEXPROC) (GLenum mode, const GLsizei* count, GLenum type, const void* const* indices, GLsizei drawcount, const GLint* basevertex);
 
 /* OpenGL function pointers. */
 extern PFNGLCREATEPROGRAMPROC glCreateProgram;
@@ -206,6 +278,23 @@ extern PFNGLGENRENDERBUFFERSPROC glGenRenderbuffers;
 extern PFNGLBINDRENDERBUFFERPROC glBindRenderbuffer;
 extern PFNGLFRAMEBUFFERRENDERBUFFERPROC glFramebufferRenderbuffer;
 extern PFNGLRENDERBUFFERSTORAGEPROC glRenderbufferStorage;
+extern PFNGLDRAWELEMENTSBASEVERTEXPROC glDrawElementsBaseVertex;
+extern PFNGLMAPBUFFERRANGEPROC glMapBufferRange;
+extern PFNGLFENCESYNCPROC glFenceSync;
+extern PFNGLCLIENTWAITSYNCPROC glClientWaitSync;
+extern PFNGLDELETESYNCPROC glDeleteSync;
+extern PFNGLCOMPRESSEDTEXIMAGE2DPROC glCompressedTexImage2D;
+extern PFNGLCOMPRESSEDTEXSUBIMAGE2DPROC glCompressedTexSubImage2D;
+extern PFNGLGETPROGRAMBINARYPROC glGetProgramBinary;
+extern PFNGLPROGRAMBINARYPROC glProgramBinary;
+extern PFNGLPROGRAMPARAMETERIPROC glProgramParameteri;
+extern PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glMaxShaderCompilerThreadsKHR;
+extern PFNGLGETPROGRAMINFOLOGPROC glGetProgramInfoLog;
+extern PFNGLBINDBUFFERRANGEPROC glBindBufferRange;
+extern PFNGLGETUNIFORMBLOCKINDEXPROC glGetUniformBlockIndex;
+extern PFNGLUNIFORMBLOCKBINDINGPROC glUniformBlockBinding;
+extern PFNGLBUFFERSTORAGEPROC glBufferStorage;
+extern PFNGLMULTIDRAWELEMENTSBASEVERTEXPROC glMultiDrawElementsBaseVertex;
 
 #else
 #include <GL/glew.h>
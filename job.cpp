@@ -0,0 +1,140 @@
+#include "global.hpp"
+#include "job.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/*
+ * Fixed pool of worker threads fed from one FIFO queue.
+ */
+static struct
+{
+	std::vector<std::thread> thread;
+	std::deque<std::function<void()>> queue;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool quit;
+} job;
+
+static void
+job_worker(void)
+{
+	for (;;)
+	{
+		std::function<void()> fn;
+
+		{
+			std::unique_lock<std::mutex> lock(job.mutex);
+
+			job.wake.wait(lock, [] { return job.quit || !job.queue.empty(); });
+			if (job.queue.empty())
+			{
+				return;
+			}
+			fn = std::move(job.queue.front());
+			job.queue.pop_front();
+		}
+		fn();
+	}
+}
+
+void
+job_begin(int workers)
+{
+	job.quit = false;
+	for (int i = 0; i < workers; i++)
+	{
+		job.thread.emplace_back(job_worker);
+	}
+}
+
+/*
+ * Finishes everything still queued, then joins the workers.
+ */
+void
+job_end(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(job.mutex);
+
+		job.quit = true;
+	}
+	job.wake.notify_all();
+	for (std::thread& t : job.thread)
+	{
+		t.join();
+	}
+	job.thread.clear();
+}
+
+/*
+ * Runs fn on a worker, or right away when there are no workers.
+ */
+void
+job_push(std::function<void()> fn)
+{
+	if (job.thread.empty())
+	{
+		fn();
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(job.mutex);
+
+		job.queue.push_back(std::move(fn));
+	}
+	job.wake.notify_one();
+}
+
+/*
+ * Calls fn(0) .. fn(count - 1) on the workers and the calling thread and
+ * returns when all calls are done. The caller takes indices as well, so
+ * this can be used from inside a job without waiting on itself.
+ */
+void
+job_parallel(uint32_t count, const std::function<void(uint32_t)>& fn)
+{
+	struct state
+	{
+		std::atomic<uint32_t> next;
+		std::atomic<uint32_t> done;
+		std::mutex mutex;
+		std::condition_variable finished;
+	};
+	std::shared_ptr<struct state> s = std::make_shared<struct state>();
+	const std::function<void(uint32_t)>* f = &fn;
+	auto run = [s, f, count]
+	{
+		uint32_t i;
+
+		while ((i = s->next.fetch_add(1)) < count)
+		{
+			(*f)(i);
+			if (s->done.fetch_add(1) + 1 == count)
+			{
+				std::lock_guard<std::mutex> lock(s->mutex);
+
+				s->finished.notify_all();
+			}
+		}
+	};
+	uint32_t helpers = std::min<uint32_t>(count, (uint32_t)job.thread.size() + 1) - 1;
+
+	s->next = 0;
+	s->done = 0;
+	if (count == 0)
+	{
+		return;
+	}
+	for (uint32_t i = 0; i < helpers; i++)
+	{
+		job_push(run);
+	}
+	run();
+
+	std::unique_lock<std::mutex> lock(s->mutex);
+	s->finished.wait(lock, [&s, count] { return s->done.load() == count; });
+}
@@ -0,0 +1,7 @@
+#pragma once
+#include <functional>
+
+extern void job_begin(int workers);
+extern void job_end(void);
+extern void job_push(std::function<void()> fn);
+extern void job_parallel(uint32_t count, const std::function<void(uint32_t)>& fn);
@@ -0,0 +1,136 @@
+#include "global.hpp"
+#include "jpeg.hpp"
+#if defined(JPEG_TURBO)
+#include <csetjmp>
+#include <cstdio>
+#include <jpeglib.h>
+
+/* libjpeg reports errors by calling error_exit, which must not return. */
+struct jpeg_error
+{
+	struct jpeg_error_mgr mgr;
+	jmp_buf jump;
+};
+
+static void
+jpeg_error_exit(j_common_ptr info)
+{
+	longjmp(((struct jpeg_error*)info->err)->jump, 1);
+}
+
+static void
+jpeg_error_silent(j_common_ptr info, int level)
+{
+	(void)info;
+	(void)level;
+}
+#endif
+
+/*
+ * Dimensions from the header, 0 on success.
+ */
+int
+jpeg_size(const uint8_t* data, size_t size, int* w, int* h)
+{
+#if defined(JPEG_TURBO)
+	struct jpeg_decompress_struct info;
+	struct jpeg_error error;
+
+	if (size < 3 || data[0] != 0xff || data[1] != 0xd8)
+	{
+		return 1;
+	}
+	info.err = jpeg_std_error(&error.mgr);
+	error.mgr.error_exit = jpeg_error_exit;
+	error.mgr.emit_message = jpeg_error_silent;
+	if (setjmp(error.jump))
+	{
+		jpeg_destroy_decompress(&info);
+		return 1;
+	}
+	jpeg_create_decompress(&info);
+	jpeg_mem_src(&info, data, (unsigned long)size);
+	jpeg_read_header(&info, TRUE);
+	*w = (int)info.image_width;
+	*h = (int)info.image_height;
+	jpeg_destroy_decompress(&info);
+	return 0;
+#else
+	(void)data;
+	(void)size;
+	(void)w;
+	(void)h;
+	return 1;
+#endif
+}
+
+/*
+ * Like stbi_load_from_memory: channels receives what the file has, desired
+ * forces 3 for RGB or 1 for grey, 0 keeps the file's. The output is
+ * ceil(width / scale) by ceil(height / scale), freed with free().
+ */
+uint8_t*
+jpeg_load(const uint8_t* data, size_t size, int scale, int* w, int* h, int* channels, int desired)
+{
+#if defined(JPEG_TURBO)
+	struct jpeg_decompress_struct info;
+	struct jpeg_error error;
+	uint8_t* volatile pixels = nullptr;
+	size_t pitch;
+
+	if (size < 3 || data[0] != 0xff || data[1] != 0xd8 || desired == 2 || desired == 4)
+	{
+		return nullptr;
+	}
+	info.err = jpeg_std_error(&error.mgr);
+	error.mgr.error_exit = jpeg_error_exit;
+	error.mgr.emit_message = jpeg_error_silent;
+	if (setjmp(error.jump))
+	{
+		jpeg_destroy_decompress(&info);
+		free(pixels);
+		return nullptr;
+	}
+	jpeg_create_decompress(&info);
+	jpeg_mem_src(&info, data, (unsigned long)size);
+	jpeg_read_header(&info, TRUE);
+	*channels = (info.jpeg_color_space == JCS_GRAYSCALE ? 1 : 3);
+	info.out_color_space = ((desired ? desired : *channels) == 1 ? JCS_GRAYSCALE : JCS_RGB);
+	info.scale_num = 1;
+	info.scale_denom = (unsigned int)scale;
+	jpeg_start_decompress(&info);
+
+	*w = (int)info.output_width;
+	*h = (int)info.output_height;
+	pitch = (size_t)info.output_width * info.output_components;
+	pixels = (uint8_t*)malloc(pitch * info.output_height);
+	if (pixels == nullptr)
+	{
+		jpeg_destroy_decompress(&info);
+		return nullptr;
+	}
+	while (info.output_scanline < info.output_height)
+	{
+		JSAMPROW row[16];
+		JDIMENSION count = std::min<JDIMENSION>(16, info.output_height - info.output_scanline);
+
+		for (JDIMENSION i = 0; i < count; i++)
+		{
+			row[i] = pixels + pitch * (info.output_scanline + i);
+		}
+		jpeg_read_scanlines(&info, row, count);
+	}
+	jpeg_finish_decompress(&info);
+	jpeg_destroy_decompress(&info);
+	return pixels;
+#else
+	(void)data;
+	(void)size;
+	(void)scale;
+	(void)w;
+	(void)h;
+	(void)channels;
+	(void)desired;
+	return nullptr;
+#endif
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+/*
+ * JPEG decoding through libjpeg-turbo when built with JPEG_TURBO, scaled by
+ * 1/1, 1/2, 1/4 or 1/8 in the DCT domain. Without it, or for anything that
+ * is not a JPEG file, these fail and callers fall back to stb_image.
+ */
+extern int jpeg_size(const uint8_t* data, size_t size, int* w, int* h);
+extern uint8_t* jpeg_load(const uint8_t* data, size_t size, int scale, int* w, int* h, int* channels, int desired);
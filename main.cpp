@@ -1,5 +1,7 @@
 #include "global.hpp"
 #include "gl.hpp"
+#include "job.hpp"
+#include "rom.hpp"
 
 static struct
 {
@@ -14,11 +16,6 @@ static struct
 		int open;
 	} display;
 	
-	struct
-	{
-		int display_new;
-	} event;
-
 	struct
 	{
 		int alt;
@@ -124,9 +121,7 @@ windowproc(HWND window, UINT message, WPARAM wParam, LPARAM lParam)
 		UINT width = LOWORD(lParam);
 		UINT height = HIWORD(lParam);
 
-		def_w = width;
-		def_h = height;
-		win32.event.display_new = 1;
+		r_resize(width, height);
 		break;
 	}
 	case WM_PAINT:
@@ -189,6 +184,8 @@ WinMain(_In_ HINSTANCE instance, _In_opt_ HINSTANCE previnstance, _In_ LPSTR cmd
 	//AllocConsole();
 	//freopen("CONOUT$", "w", stdout);
 
+	settings_parse(__argc, __argv);
+
 	/* Find wgl functions for context creation. */
 	wcex = {};
 	wcex.cbSize = sizeof(wcex);
@@ -318,6 +315,23 @@ WinMain(_In_ HINSTANCE instance, _In_opt_ HINSTANCE previnstance, _In_ LPSTR cmd
 	glBindRenderbuffer = (PFNGLBINDRENDERBUFFERPROC)wglGetProcAddress("glBindRenderbuffer");
 	glFramebufferRenderbuffer = (PFNGLFRAMEBUFFERRENDERBUFFERPROC)wglGetProcAddress("glFramebufferRenderbuffer");
 	glRenderbufferStorage = (PFNGLRENDERBUFFERSTORAGEPROC)wglGetProcAddress("glRenderbufferStorage");
+	glDrawElementsBaseVertex = (PFNGLDRAWELEMENTSBASEVERTEXPROC)wglGetProcAddress("glDrawElementsBaseVertex");
+	glMapBufferRange = (PFNGLMAPBUFFERRANGEPROC)wglGetProcAddress("glMapBufferRange");
+	glFenceSync = (PFNGLFENCESYNCPROC)wglGetProcAddress("glFenceSync");
+	glClientWaitSync = (PFNGLCLIENTWAITSYNCPROC)wglGetProcAddress("glClientWaitSync");
+	glDeleteSync = (PFNGLDELETESYNCPROC)wglGetProcAddress("glDeleteSync");
+	glCompressedTexImage2D = (PFNGLCOMPRESSEDTEXIMAGE2DPROC)wglGetProcAddress("glCompressedTexImage2D");
+	glCompressedTexSubImage2D = (PFNGLCOMPRESSEDTEXSUBIMAGE2DPROC)wglGetProcAddress("glCompressedTexSubImage2D");
+	glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC)wglGetProcAddress("glGetProgramBinary");
+	glProgramBinary = (PFNGLPROGRAMBINARYPROC)wglGetProcAddress("glProgramBinary");
+	glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)wglGetProcAddress("glProgramParameteri");
+	glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)wglGetProcAddress("glMaxShaderCompilerThreadsKHR");
+	glGetProgramInfoLog = (PFNGLGETPROGRAMINFOLOGPROC)wglGetProcAddress("glGetProgramInfoLog");
+	glBindBufferRange = (PFNGLBINDBUFFERRANGEPROC)wglGetProcAddress("glBindBufferRange");
+	glGetUniformBlockIndex = (PFNGLGETUNIFORMBLOCKINDEXPROC)wglGetProcAddress("glGetUniformBlockIndex");
+	glUniformBlockBinding = (PFNGLUNIFORMBLOCKBINDINGPROC)wglGetProcAddress("glUniformBlockBinding");
+	glBufferStorage = (PFNGLBUFFERSTORAGEPROC)wglGetProcAddress("glBufferStorage");
+	glMultiDrawElementsBaseVertex = (PFNGLMULTIDRAWELEMENTSBASEVERTEXPROC)wglGetProcAddress("glMultiDrawElementsBaseVertex");
 	strcpy_s(title, "matf rg 2021/2022 (");
 	strcat_s(title, 128 - 1, (char*)glGetString(GL_VERSION));
 	strcat_s(title, 128, ")");
@@ -327,6 +341,8 @@ WinMain(_In_ HINSTANCE instance, _In_opt_ HINSTANCE previnstance, _In_ LPSTR cmd
 
 	message = { };
 	tick = { };
+	job_begin(settings.threads - 1);
+	rom_pak_open("rom.pak"); /* Loose files under rom/ otherwise. */
 	r_glbegin();
 	while (win32.display.open)
 	{
@@ -341,18 +357,6 @@ WinMain(_In_ HINSTANCE instance, _In_opt_ HINSTANCE previnstance, _In_ LPSTR cmd
 			r_newscene(scene::SCENE_VOID);
 		}
 
-		if (win32.event.display_new)
-		{
-			static int first = 1;
-
-			if (!first)
-			{
-				r_glbegin();
-			}
-			first = 0;
-			win32.event.display_new = 0;
-		}
-
 		if (win32.controller.lmb || win32.controller.mmb)
 		{
 			tick.cursor.dx = tick.cursor.x - win32.cursor.x;
@@ -414,6 +418,7 @@ WinMain(_In_ HINSTANCE instance, _In_opt_ HINSTANCE previnstance, _In_ LPSTR cmd
 	}
 	PlaySound(TEXT("rom/audio/DSHOOF.wav"), NULL, SND_FILENAME | SND_SYNC);
 	r_glexit();
+	job_end();
 	ReleaseDC(window, hdc);
 	DestroyWindow(window);
 	UnregisterClass(classmain, instance);
@@ -2,6 +2,8 @@
 #include "global.hpp"
 #include <GLFW/glfw3.h>
 #include "gl.hpp"
+#include "job.hpp"
+#include "rom.hpp"
 
 static struct r_tick tick;
 
@@ -22,10 +24,7 @@ struct
 void
 framebuffer_size_callback(GLFWwindow *window, int width, int height)
 {
-	def_w = width;
-	def_h = height;
-	r_glbegin();
-	//glViewport(0, 0, width, height);
+	r_resize(width, height);
 }
 
 /*
@@ -135,8 +134,10 @@ processInput(GLFWwindow *window)
 int
 main(int argc, char **argv)
 {
-	
-	
+	settings_parse(argc, argv);
+	job_begin(settings.threads - 1);
+	rom_pak_open("rom.pak"); /* Loose files under rom/ otherwise. */
+
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -206,6 +207,7 @@ main(int argc, char **argv)
     		glfwSwapBuffers(window);
         	glfwPollEvents();
     	}
+	job_end();
 	return 0;
 }
 
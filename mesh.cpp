@@ -0,0 +1,916 @@
+#include "global.hpp"
+#include "mesh.hpp"
+#include "job.hpp"
+#include <atomic>
+#include <cstring>
+#include <charconv>
+#include <chrono>
+#include <string_view>
+
+#define MESH_CACHE_VERSION 4
+
+/* Smallest piece of an OBJ file parsed on its own thread. */
+#define OBJ_CHUNK_MIN (256 * 1024)
+
+/*
+ * Mesh cache file layout, every offset is from the start of the file:
+ *
+ * header
+ * vertex data  (vertex_count * MESH_VERTEX_FLOATS floats, 64 byte aligned)
+ * index data   (index_count * index_size bytes, 64 byte aligned)
+ * group table  (group_count * struct mesh_cache_group)
+ * string table (NUL terminated names)
+ */
+struct mesh_cache_header
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint64_t source_hash;
+	uint32_t vertex_count;
+	uint32_t index_count;
+	uint32_t index_size;
+	uint32_t group_count;
+	uint64_t vertex_offset;
+	uint64_t index_offset;
+	uint64_t group_offset;
+	uint64_t string_offset;
+	uint64_t string_size;
+};
+
+/*
+ * Raw OBJ records. Corners hold 1-based v/vt/vn indices, three per face.
+ */
+struct obj_group
+{
+	uint32_t cfirst;
+	std::string material;
+	std::string name;
+};
+
+/*
+ * Records of one line-aligned chunk of the file. Faces and usemtl before the
+ * chunk's first group continue the group of the previous chunk. Negative
+ * indices are resolved against the chunk's own records; the slots listed in
+ * relative still need the record counts of the previous chunks added.
+ */
+struct obj_data
+{
+	std::vector<glm::vec3> position;
+	std::vector<glm::vec2> uv;
+	std::vector<glm::vec3> normal;
+	std::vector<glm::ivec3> corner;
+	std::vector<struct obj_group> group;
+
+	std::vector<uint32_t> relative; /* corner * 3 + axis */
+	bool lead_material_set = false;
+	std::string lead_material;
+	uint32_t lines = 0;
+	const char* error = nullptr;
+};
+
+/*
+ * Tokenizer over a contiguous text buffer. Fields are separated by spaces or
+ * tabs, numbers go through std::from_chars so nothing is allocated per line
+ * and the current locale is never consulted.
+ */
+static inline const char*
+text_skip(const char* p, const char* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t'))
+	{
+		p++;
+	}
+	return p;
+}
+
+static inline int
+text_float(const char** p, const char* end, float* out)
+{
+	const char* s = text_skip(*p, end);
+	std::from_chars_result r;
+
+	if (s < end && *s == '+')
+	{
+		s++;
+	}
+	r = std::from_chars(s, end, *out);
+	if (r.ec != std::errc())
+	{
+		return 1;
+	}
+	*p = r.ptr;
+	return 0;
+}
+
+static inline int
+text_int(const char** p, const char* end, int* out)
+{
+	std::from_chars_result r = std::from_chars(*p, end, *out);
+
+	if (r.ec != std::errc())
+	{
+		return 1;
+	}
+	*p = r.ptr;
+	return 0;
+}
+
+/* Rest of the line with surrounding blanks removed. */
+static inline std::string_view
+text_rest(const char* p, const char* end)
+{
+	p = text_skip(p, end);
+	while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+	{
+		end--;
+	}
+	return std::string_view(p, end - p);
+}
+
+/* Line keyword, the first field. */
+static inline std::string_view
+text_keyword(const char** p, const char* end)
+{
+	const char* s = text_skip(*p, end);
+	const char* e = s;
+
+	while (e < end && *e != ' ' && *e != '\t')
+	{
+		e++;
+	}
+	*p = e;
+	return std::string_view(s, e - s);
+}
+
+/* Next line in [*p, end), without the line break. */
+static inline int
+text_line(const char** p, const char* end, const char** line, const char** line_end)
+{
+	const char* eol;
+
+	if (*p >= end)
+	{
+		return 0;
+	}
+	eol = (const char*)memchr(*p, '\n', end - *p);
+	if (!eol)
+	{
+		eol = end;
+	}
+	*line = *p;
+	*line_end = eol;
+	if (*line_end > *line && (*line_end)[-1] == '\r')
+	{
+		(*line_end)--;
+	}
+	*p = (eol < end ? eol + 1 : end);
+	return 1;
+}
+
+/*
+ * Face corner "v/vt/vn", slot is the index the corner will be stored at.
+ */
+static inline int
+obj_corner(const char** p, const char* end, struct obj_data* o, uint32_t slot, glm::ivec3* c)
+{
+	const char* s = text_skip(*p, end);
+
+	if (text_int(&s, end, &c->x) || s >= end || *s++ != '/'
+		|| text_int(&s, end, &c->y) || s >= end || *s++ != '/'
+		|| text_int(&s, end, &c->z))
+	{
+		return 1;
+	}
+	if (c->x < 0)
+	{
+		c->x += (int)o->position.size() + 1;
+		o->relative.push_back(slot * 3 + 0);
+	}
+	if (c->y < 0)
+	{
+		c->y += (int)o->uv.size() + 1;
+		o->relative.push_back(slot * 3 + 1);
+	}
+	if (c->z < 0)
+	{
+		c->z += (int)o->normal.size() + 1;
+		o->relative.push_back(slot * 3 + 2);
+	}
+	*p = s;
+	return 0;
+}
+
+static void
+mesh_report(const char* path, size_t bytes, uint32_t lines, uint32_t threads, std::chrono::steady_clock::time_point begin)
+{
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	if (seconds <= 0.0)
+	{
+		seconds = 1e-9;
+	}
+	std::cout << path << ": " << bytes / 1048576.0 << " MB, " << lines << " lines in " << seconds * 1000.0 << " ms ("
+		<< bytes / 1048576.0 / seconds << " MB/s, " << (uint64_t)(lines / seconds) << " lines/s, " << threads << (threads == 1 ? " thread)" : " threads)") << std::endl;
+}
+
+/*
+ * One pass over a chunk into raw records.
+ */
+static int
+obj_parse(struct obj_data* o, const char* data, size_t size)
+{
+	const char* p = data;
+	const char* end = data + size;
+	const char* s;
+	const char* e;
+
+	while (text_line(&p, end, &s, &e))
+	{
+		std::string_view key;
+
+		o->lines++;
+		key = text_keyword(&s, e);
+		if (key.empty() || key[0] == '#')
+		{
+			continue;
+		}
+
+		if (key == "v")
+		{
+			glm::vec3 v;
+
+			if (text_float(&s, e, &v.x) || text_float(&s, e, &v.y) || text_float(&s, e, &v.z))
+			{
+				o->error = "bad vertex";
+				return 1;
+			}
+			v.y *= -1;
+			o->position.push_back(v);
+		}
+		else if (key == "vt")
+		{
+			glm::vec2 t;
+
+			if (text_float(&s, e, &t.x) || text_float(&s, e, &t.y))
+			{
+				o->error = "bad uv";
+				return 1;
+			}
+			o->uv.push_back(t);
+		}
+		else if (key == "vn")
+		{
+			glm::vec3 n;
+
+			if (text_float(&s, e, &n.x) || text_float(&s, e, &n.y) || text_float(&s, e, &n.z))
+			{
+				o->error = "bad normal";
+				return 1;
+			}
+			o->normal.push_back(n);
+		}
+		else if (key == "f")
+		{
+			uint32_t slot = (uint32_t)o->corner.size();
+			glm::ivec3 c[3];
+
+			if (obj_corner(&s, e, o, slot, &c[0]) || obj_corner(&s, e, o, slot + 1, &c[1]) || obj_corner(&s, e, o, slot + 2, &c[2]))
+			{
+				o->error = "bad face";
+				return 1;
+			}
+			o->corner.push_back(c[0]);
+			o->corner.push_back(c[1]);
+			o->corner.push_back(c[2]);
+		}
+		else if (key == "g")
+		{
+			std::string_view name = text_rest(s, e);
+
+			if (name != "default")
+			{
+				o->group.push_back({});
+				o->group.back().cfirst = (uint32_t)o->corner.size();
+				o->group.back().name = name;
+			}
+		}
+		else if (key == "usemtl")
+		{
+			if (o->group.empty())
+			{
+				o->lead_material_set = true;
+				o->lead_material = text_rest(s, e);
+			}
+			else
+			{
+				o->group.back().material = text_rest(s, e);
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Joins the chunks in file order. Record counts are prefix-summed to fix
+ * chunk-relative indices and group corner offsets, the first chunk is moved
+ * rather than copied.
+ */
+static int
+obj_merge(struct obj_data* o, std::vector<struct obj_data>& chunk, const char* path)
+{
+	uint32_t lines = 0;
+
+	for (struct obj_data& c : chunk)
+	{
+		const uint32_t lead = (c.group.empty() ? (uint32_t)c.corner.size() : c.group[0].cfirst);
+		const glm::ivec3 base = { (int)o->position.size(), (int)o->uv.size(), (int)o->normal.size() };
+		const uint32_t cbase = (uint32_t)o->corner.size();
+
+		if (c.error)
+		{
+			std::cout << path << ":" << lines + c.lines << ": " << c.error << std::endl;
+			return 1;
+		}
+		if ((lead > 0 || c.lead_material_set) && o->group.empty())
+		{
+			std::cout << path << ":" << lines + 1 << ": face or material outside of a group" << std::endl;
+			return 1;
+		}
+		if (c.lead_material_set)
+		{
+			o->group.back().material = c.lead_material;
+		}
+
+		for (uint32_t r : c.relative)
+		{
+			c.corner[r / 3][r % 3] += base[r % 3];
+		}
+		for (struct obj_group& g : c.group)
+		{
+			g.cfirst += cbase;
+		}
+
+		if (&c == &chunk[0])
+		{
+			o->position = std::move(c.position);
+			o->uv = std::move(c.uv);
+			o->normal = std::move(c.normal);
+			o->corner = std::move(c.corner);
+			o->group = std::move(c.group);
+		}
+		else
+		{
+			o->position.insert(o->position.end(), c.position.begin(), c.position.end());
+			o->uv.insert(o->uv.end(), c.uv.begin(), c.uv.end());
+			o->normal.insert(o->normal.end(), c.normal.begin(), c.normal.end());
+			o->corner.insert(o->corner.end(), c.corner.begin(), c.corner.end());
+			o->group.insert(o->group.end(), std::make_move_iterator(c.group.begin()), std::make_move_iterator(c.group.end()));
+		}
+		lines += c.lines;
+	}
+	o->lines = lines;
+	return 0;
+}
+
+/*
+ * Expand corners to the interleaved vertex stream, tangent and bitangent are
+ * left zero. Faces are written to disjoint ranges, so blocks of them are
+ * expanded in parallel.
+ */
+static int
+obj_build(struct mesh* m, const struct obj_data* o, const char* path)
+{
+	const uint32_t faces = (uint32_t)(o->corner.size() / 3);
+	const uint32_t block = 16384;
+	std::atomic<int> bad(0);
+	uint32_t i;
+
+	m->vertex.resize(o->corner.size() * MESH_VERTEX_FLOATS);
+	job_parallel((faces + block - 1) / block, [m, o, faces, block, &bad](uint32_t b)
+	{
+		const uint32_t last = std::min(faces, (b + 1) * block);
+
+		for (uint32_t face = b * block; face < last; face++)
+		{
+			const glm::ivec3* c = &o->corner[face * 3];
+			float* out = &m->vertex[face * 3 * MESH_VERTEX_FLOATS];
+			uint32_t j;
+
+			for (j = 0; j < 3; j++)
+			{
+				if (c[j].x < 1 || c[j].x > (int)o->position.size() || c[j].y < 1 || c[j].y > (int)o->uv.size() || c[j].z < 1 || c[j].z > (int)o->normal.size())
+				{
+					bad = 1;
+					return;
+				}
+			}
+
+			for (j = 0; j < 3; j++)
+			{
+				const glm::vec3& p = o->position[c[j].x - 1];
+				const glm::vec2& t = o->uv[c[j].y - 1];
+				const glm::vec3& n = o->normal[c[j].z - 1];
+
+				*out++ = p.x;
+				*out++ = p.y;
+				*out++ = p.z;
+				*out++ = t.x;
+				*out++ = t.y;
+				*out++ = n.x;
+				*out++ = n.y;
+				*out++ = n.z;
+				for (uint32_t k = 0; k < 6; k++)
+				{
+					*out++ = 0.0f;
+				}
+			}
+		}
+	});
+	if (bad)
+	{
+		std::cout << path << ": face index out of range" << std::endl;
+		return 1;
+	}
+
+	m->group.resize(o->group.size());
+	for (i = 0; i < o->group.size(); i++)
+	{
+		uint32_t cend = (i + 1 < o->group.size() ? o->group[i + 1].cfirst : (uint32_t)o->corner.size());
+
+		m->group[i].vfirst = o->group[i].cfirst;
+		m->group[i].vcount = cend - o->group[i].cfirst;
+		m->group[i].material = o->group[i].material;
+		m->group[i].name = o->group[i].name;
+	}
+	return 0;
+}
+
+/*
+ * Indices are 16 bit when every group has few enough vertices, they are
+ * relative to the group's first vertex.
+ */
+static uint32_t
+mesh_index_size(const struct mesh* m)
+{
+	for (const struct mesh_group& g : m->group)
+	{
+		if (g.vcount > 65536)
+		{
+			return 4;
+		}
+	}
+	return 2;
+}
+
+static inline uint32_t
+weld_hash(const float* v)
+{
+	uint32_t hash = 0x811c9dc5u;
+
+	for (uint32_t i = 0; i < MESH_VERTEX_FLOATS; i++)
+	{
+		uint32_t bits;
+
+		memcpy(&bits, &v[i], sizeof(bits));
+		hash = (hash ^ bits) * 0x01000193u;
+		hash ^= hash >> 15;
+	}
+	return hash;
+}
+
+/*
+ * Welds one group's corners. Vertices are equal when all of position, uv,
+ * normal and tangent frame match bit for bit; the table is open addressing
+ * over indices into the output.
+ */
+static void
+weld_group(const float* soup, uint32_t count, std::vector<float>* vertex, std::vector<uint32_t>* index)
+{
+	uint32_t size = 16;
+	std::vector<uint32_t> table;
+
+	while (size < count * 2)
+	{
+		size *= 2;
+	}
+	table.assign(size, UINT32_MAX);
+	vertex->reserve(count * MESH_VERTEX_FLOATS / 2);
+	index->resize(count);
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const float* v = soup + i * MESH_VERTEX_FLOATS;
+		uint32_t h = weld_hash(v) & (size - 1);
+
+		while (table[h] != UINT32_MAX && memcmp(vertex->data() + table[h] * MESH_VERTEX_FLOATS, v, MESH_VERTEX_FLOATS * sizeof(float)) != 0)
+		{
+			h = (h + 1) & (size - 1);
+		}
+		if (table[h] == UINT32_MAX)
+		{
+			table[h] = (uint32_t)(vertex->size() / MESH_VERTEX_FLOATS);
+			vertex->insert(vertex->end(), v, v + MESH_VERTEX_FLOATS);
+		}
+		(*index)[i] = table[h];
+	}
+}
+
+/*
+ * Turns the triangle soup from obj_build into indexed geometry, groups are
+ * welded in parallel.
+ */
+static void
+mesh_weld(struct mesh* m)
+{
+	const size_t soup = m->vertex.size() / MESH_VERTEX_FLOATS;
+	std::vector<std::vector<float>> vertex(m->group.size());
+	std::vector<std::vector<uint32_t>> index(m->group.size());
+	std::vector<float> out;
+	uint32_t vfirst = 0, ifirst = 0;
+
+	job_parallel((uint32_t)m->group.size(), [m, &vertex, &index](uint32_t i)
+	{
+		weld_group(m->vertex.data() + (size_t)m->group[i].vfirst * MESH_VERTEX_FLOATS, m->group[i].vcount, &vertex[i], &index[i]);
+	});
+
+	m->index.clear();
+	for (uint32_t i = 0; i < m->group.size(); i++)
+	{
+		m->group[i].vfirst = vfirst;
+		m->group[i].vcount = (uint32_t)(vertex[i].size() / MESH_VERTEX_FLOATS);
+		m->group[i].ifirst = ifirst;
+		m->group[i].icount = (uint32_t)index[i].size();
+		out.insert(out.end(), vertex[i].begin(), vertex[i].end());
+		m->index.insert(m->index.end(), index[i].begin(), index[i].end());
+		vfirst += m->group[i].vcount;
+		ifirst += m->group[i].icount;
+	}
+	m->vertex = std::move(out);
+
+	std::cout << "welded " << soup << " corners to " << vfirst << " vertices, " << (soup * MESH_VERTEX_FLOATS * sizeof(float)) / 1024 << " KB -> "
+		<< (m->vertex.size() * sizeof(float) + m->index.size() * mesh_index_size(m)) / 1024 << " KB with " << mesh_index_size(m) * 8 << " bit indices" << std::endl;
+}
+
+/*
+ * Index buffer in the format the GPU gets, returns the index size in bytes.
+ */
+uint32_t
+mesh_index_pack(const struct mesh* m, std::vector<uint8_t>* out)
+{
+	uint32_t size = mesh_index_size(m);
+
+	out->resize(m->index.size() * size);
+	if (size == 4)
+	{
+		memcpy(out->data(), m->index.data(), out->size());
+	}
+	else
+	{
+		uint16_t* p = (uint16_t*)out->data();
+
+		for (size_t i = 0; i < m->index.size(); i++)
+		{
+			p[i] = (uint16_t)m->index[i];
+		}
+	}
+	return size;
+}
+
+/*
+ * With more than one thread the file is split at line breaks into chunks of
+ * at least OBJ_CHUNK_MIN bytes that are parsed in parallel, the result is the
+ * same as parsing it in one piece.
+ */
+int
+mesh_load_obj(struct mesh* m, const char* path)
+{
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	std::vector<struct obj_data> chunk;
+	std::vector<size_t> bound;
+	struct obj_data o;
+	struct rom_file file;
+	const char* data;
+	uint32_t count, i;
+	size_t size;
+
+	m->vertex.clear();
+	m->group.clear();
+	if (rom_map(&file, path))
+	{
+		return 1;
+	}
+	data = (const char*)file.data;
+	size = file.size;
+
+	count = (uint32_t)std::max<size_t>(1, std::min<size_t>(settings.threads, size / OBJ_CHUNK_MIN));
+	bound.push_back(0);
+	for (i = 1; i < count; i++)
+	{
+		size_t at = std::max(bound.back(), size / count * i);
+		const char* eol = (const char*)memchr(data + at, '\n', size - at);
+
+		bound.push_back(eol ? eol - data + 1 : size);
+	}
+	bound.push_back(size);
+
+	chunk.resize(count);
+	job_parallel(count, [&chunk, &bound, data](uint32_t i)
+	{
+		obj_parse(&chunk[i], data + bound[i], bound[i + 1] - bound[i]);
+	});
+	if (obj_merge(&o, chunk, path) || obj_build(m, &o, path))
+	{
+		rom_unmap(&file);
+		return 1;
+	}
+	rom_unmap(&file);
+	mesh_report(path, size, o.lines, count, begin);
+	mesh_weld(m);
+	mesh_tangents(m);
+	mesh_optimize(m, path);
+	return 0;
+}
+
+int
+mesh_load_mtl(std::vector<struct mesh_material>* out, const char* path)
+{
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	struct mesh_material* active = nullptr;
+	struct rom_file file;
+	const char* p;
+	const char* end;
+	const char* s;
+	const char* e;
+	uint32_t lines = 0;
+	size_t size;
+
+	out->clear();
+	if (rom_map(&file, path))
+	{
+		return 1;
+	}
+	p = (const char*)file.data;
+	end = p + file.size;
+	while (text_line(&p, end, &s, &e))
+	{
+		std::string_view key;
+
+		lines++;
+		key = text_keyword(&s, e);
+		if (key.empty() || key[0] == '#')
+		{
+			continue;
+		}
+
+		if (key == "newmtl")
+		{
+			out->push_back({});
+			active = &out->back();
+			active->name = text_rest(s, e);
+			continue;
+		}
+		if (!active)
+		{
+			out->push_back({});
+			active = &out->back();
+			active->name = "none";
+		}
+
+		if (key == "Ka")
+		{
+			if (text_float(&s, e, &active->ambient.r) || text_float(&s, e, &active->ambient.g) || text_float(&s, e, &active->ambient.b))
+			{
+				std::cout << path << ":" << lines << ": bad Ka" << std::endl;
+			}
+		}
+		else if (key == "Kd")
+		{
+			if (text_float(&s, e, &active->diffuse.r) || text_float(&s, e, &active->diffuse.g) || text_float(&s, e, &active->diffuse.b))
+			{
+				std::cout << path << ":" << lines << ": bad Kd" << std::endl;
+			}
+		}
+		else if (key == "Ks")
+		{
+			if (text_float(&s, e, &active->specular.r) || text_float(&s, e, &active->specular.g) || text_float(&s, e, &active->specular.b))
+			{
+				std::cout << path << ":" << lines << ": bad Ks" << std::endl;
+			}
+		}
+		else if (key == "Ns")
+		{
+			if (text_float(&s, e, &active->specular.a))
+			{
+				std::cout << path << ":" << lines << ": bad Ns" << std::endl;
+			}
+		}
+		else if (key == "Tf")
+		{
+			float tf = 1.0f;
+
+			if (text_float(&s, e, &tf))
+			{
+				std::cout << path << ":" << lines << ": bad Tf" << std::endl;
+			}
+			active->transparency = 1.0f - tf;
+		}
+		else if (key == "map_Kd")
+		{
+			std::string_view name = text_keyword(&s, e);
+
+			/* Example -mm_0.7181_0.214286_NameOfFile.jpg */
+			if (!name.empty() && name[0] == '-')
+			{
+				size_t i = name.find('_');
+
+				i = (i == std::string_view::npos ? i : name.find('_', i + 1));
+				i = (i == std::string_view::npos ? i : name.find('_', i + 1));
+				if (i != std::string_view::npos)
+				{
+					name = name.substr(i + 1);
+				}
+			}
+			active->diffuse_path = name;
+			active->diffuse = { 1.0f, 1.0f, 1.0f };
+		}
+		else if (key == "bump")
+		{
+			/* bump  -bm 1 WoodFlooring14_NRM_6K.jpg */
+			const char* option = s;
+
+			if (text_keyword(&option, e) == "-bm")
+			{
+				text_keyword(&option, e);
+				s = option;
+			}
+			active->normal_path = text_rest(s, e);
+		}
+	}
+	size = file.size;
+	rom_unmap(&file);
+	mesh_report(path, size, lines, 1, begin);
+	return 0;
+}
+
+/*
+ * The cache is valid when its source is unchanged. Size and mtime are checked
+ * first, the content hash only when the mtime moved (checkouts, copies).
+ * A cache without its source is used as is.
+ */
+int
+mesh_cache_open(struct mesh_cache* c, const char* path, const char* source_path)
+{
+	const struct mesh_cache_header* header;
+	struct rom_info info;
+
+	*c = { };
+	if (rom_map(&c->file, path))
+	{
+		return 1;
+	}
+	if (c->file.size < sizeof(struct mesh_cache_header))
+	{
+		mesh_cache_close(c);
+		return 1;
+	}
+
+	header = (const struct mesh_cache_header*)c->file.data;
+	if (memcmp(header->magic, "MESH", 4) != 0 || header->version != MESH_CACHE_VERSION
+		|| header->vertex_offset + (uint64_t)header->vertex_count * MESH_VERTEX_FLOATS * sizeof(float) > c->file.size
+		|| (header->index_size != 2 && header->index_size != 4)
+		|| header->index_offset + (uint64_t)header->index_count * header->index_size > c->file.size
+		|| header->group_offset + (uint64_t)header->group_count * sizeof(struct mesh_cache_group) > c->file.size
+		|| header->string_offset + header->string_size > c->file.size
+		|| header->string_size == 0 || c->file.data[header->string_offset + header->string_size - 1] != '\0')
+	{
+		mesh_cache_close(c);
+		return 1;
+	}
+
+	if (rom_stat(source_path, &info) == 0 && (info.size != header->source_size || info.mtime != header->source_mtime))
+	{
+		struct rom_file source;
+		int stale;
+
+		if (info.size != header->source_size || rom_map(&source, source_path))
+		{
+			mesh_cache_close(c);
+			return 1;
+		}
+		stale = rom_hash(source.data, source.size) != header->source_hash;
+		rom_unmap(&source);
+		if (stale)
+		{
+			mesh_cache_close(c);
+			return 1;
+		}
+	}
+
+	c->vertex = (const float*)(c->file.data + header->vertex_offset);
+	c->vertex_count = header->vertex_count;
+	c->index = c->file.data + header->index_offset;
+	c->index_count = header->index_count;
+	c->index_size = header->index_size;
+	c->group = (const struct mesh_cache_group*)(c->file.data + header->group_offset);
+	c->group_count = header->group_count;
+	c->string = (const char*)(c->file.data + header->string_offset);
+	for (uint32_t i = 0; i < c->group_count; i++)
+	{
+		if (c->group[i].material >= header->string_size || c->group[i].name >= header->string_size
+			|| (uint64_t)c->group[i].vfirst + c->group[i].vcount > c->vertex_count
+			|| (uint64_t)c->group[i].ifirst + c->group[i].icount > c->index_count)
+		{
+			mesh_cache_close(c);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Written to a temporary file first so a crash never leaves a truncated cache.
+ */
+int
+mesh_cache_write(const struct mesh* m, const char* path, const char* source_path)
+{
+	struct mesh_cache_header header = { };
+	std::vector<struct mesh_cache_group> group;
+	std::vector<uint8_t> index;
+	std::string string;
+	std::string temp_path = std::string(path) + ".tmp";
+	struct rom_file source;
+	struct rom_info info;
+	static const char zero[64] = { };
+
+	if (rom_stat(source_path, &info) || rom_map(&source, source_path))
+	{
+		return 1;
+	}
+	memcpy(header.magic, "MESH", 4);
+	header.version = MESH_CACHE_VERSION;
+	header.source_size = info.size;
+	header.source_mtime = info.mtime;
+	header.source_hash = rom_hash(source.data, source.size);
+	rom_unmap(&source);
+
+	string.push_back('\0');
+	for (const struct mesh_group& g : m->group)
+	{
+		struct mesh_cache_group r;
+
+		r.vfirst = g.vfirst;
+		r.vcount = g.vcount;
+		r.ifirst = g.ifirst;
+		r.icount = g.icount;
+		r.material = (uint32_t)string.size();
+		string.append(g.material).push_back('\0');
+		r.name = (uint32_t)string.size();
+		string.append(g.name).push_back('\0');
+		group.push_back(r);
+	}
+
+	header.vertex_count = (uint32_t)(m->vertex.size() / MESH_VERTEX_FLOATS);
+	header.index_count = (uint32_t)m->index.size();
+	header.index_size = mesh_index_pack(m, &index);
+	header.group_count = (uint32_t)group.size();
+	header.vertex_offset = (sizeof(header) + 63) & ~(uint64_t)63;
+	header.index_offset = (header.vertex_offset + sizeof(float) * m->vertex.size() + 63) & ~(uint64_t)63;
+	header.group_offset = header.index_offset + index.size();
+	header.string_offset = header.group_offset + sizeof(struct mesh_cache_group) * group.size();
+	header.string_size = string.size();
+
+	{
+		std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+
+		out.write((const char*)&header, sizeof(header));
+		out.write(zero, header.vertex_offset - sizeof(header));
+		out.write((const char*)m->vertex.data(), sizeof(float) * m->vertex.size());
+		out.write(zero, header.index_offset - header.vertex_offset - sizeof(float) * m->vertex.size());
+		out.write((const char*)index.data(), index.size());
+		out.write((const char*)group.data(), sizeof(struct mesh_cache_group) * group.size());
+		out.write(string.data(), string.size());
+		if (!out)
+		{
+			out.close();
+			std::remove(temp_path.c_str());
+			return 1;
+		}
+	}
+
+	std::remove(path);
+	if (std::rename(temp_path.c_str(), path) != 0)
+	{
+		std::remove(temp_path.c_str());
+		return 1;
+	}
+	return 0;
+}
+
+void
+mesh_cache_close(struct mesh_cache* c)
+{
+	rom_unmap(&c->file);
+	*c = { };
+}
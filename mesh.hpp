@@ -0,0 +1,100 @@
+#pragma once
+#include "rom.hpp"
+
+/* Position, uv, normal, tangent, bitangent. */
+#define MESH_VERTEX_FLOATS (3 + 2 + 3 + 3 + 3)
+
+/*
+ * Compact vertex, 20 bytes instead of 56. Position is unorm16 inside the
+ * owning group's bounding box with the tangent sign in w, uv is half float,
+ * normal and tangent are octahedral snorm16. The bitangent is rebuilt from
+ * normal, tangent and sign.
+ */
+struct mesh_vertex_packed
+{
+	uint16_t position[4];
+	uint16_t uv[2];
+	int16_t normal[2];
+	int16_t tangent[2];
+};
+
+/*
+ * Vertices [vfirst, vfirst + vcount) are drawn by indices [ifirst, ifirst + icount),
+ * index values are relative to vfirst.
+ */
+struct mesh_group
+{
+	uint32_t vfirst;
+	uint32_t vcount;
+	uint32_t ifirst;
+	uint32_t icount;
+	std::string material;
+	std::string name;
+};
+
+/*
+ * Indexed mesh ready for the main VAO, built from an OBJ file. Every group
+ * owns its own run of welded vertices.
+ */
+struct mesh
+{
+	std::vector<float> vertex;
+	std::vector<uint32_t> index;
+	std::vector<struct mesh_group> group;
+};
+
+/*
+ * Material as read from an MTL file. Texture paths are relative to the file.
+ */
+struct mesh_material
+{
+	std::string name;
+	glm::vec3 ambient = { 0.0f, 0.0f, 0.0f }; /* Ka */
+	glm::vec3 diffuse = { 1.0f, 1.0f, 1.0f }; /* Kd */
+	glm::vec4 specular = { 0.0f, 0.0f, 0.0f, 20.0 }; /* Ks, Ns */
+	float transparency = 0.0f; /* 1 - Tf */
+	std::string diffuse_path; /* map_Kd */
+	std::string normal_path; /* bump */
+};
+
+/*
+ * Group record inside a mesh cache. Names are offsets into the string table.
+ */
+struct mesh_cache_group
+{
+	uint32_t vfirst;
+	uint32_t vcount;
+	uint32_t ifirst;
+	uint32_t icount;
+	uint32_t material;
+	uint32_t name;
+};
+
+/*
+ * Mesh cache mapped from disk. All pointers point into the mapping and are
+ * valid until mesh_cache_close.
+ */
+struct mesh_cache
+{
+	struct rom_file file;
+	const float* vertex;
+	uint32_t vertex_count;
+	const void* index;
+	uint32_t index_count;
+	uint32_t index_size;
+	const struct mesh_cache_group* group;
+	uint32_t group_count;
+	const char* string;
+};
+
+extern int mesh_load_obj(struct mesh* m, const char* path);
+extern void mesh_tangents(struct mesh* m);
+extern void mesh_optimize(struct mesh* m, const char* path);
+extern void mesh_bounds(const float* vertex, uint32_t count, glm::vec3* lo, glm::vec3* hi);
+extern void mesh_pack(struct mesh_vertex_packed* out, const float* vertex, uint32_t count, glm::vec3* offset, glm::vec3* scale);
+extern void mesh_pack_bounds(struct mesh_vertex_packed* out, const float* vertex, uint32_t count, glm::vec3 offset, glm::vec3 scale);
+extern uint32_t mesh_index_pack(const struct mesh* m, std::vector<uint8_t>* out);
+extern int mesh_load_mtl(std::vector<struct mesh_material>* out, const char* path);
+extern int mesh_cache_open(struct mesh_cache* c, const char* path, const char* source_path);
+extern int mesh_cache_write(const struct mesh* m, const char* path, const char* source_path);
+extern void mesh_cache_close(struct mesh_cache* c);
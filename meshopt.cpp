@@ -0,0 +1,424 @@
+#include "global.hpp"
+#include "mesh.hpp"
+#include "job.hpp"
+#include "glm/gtc/packing.hpp"
+#include <cfloat>
+
+/* Post-transform cache size the triangle order is tuned for. */
+#define MESHOPT_CACHE 16
+
+/*
+ * Vertices transformed for a FIFO post-transform cache of the given size.
+ * ACMR is this over the triangle count, ATVR over the vertex count.
+ */
+static uint32_t
+meshopt_transformed(const uint32_t* index, uint32_t count, uint32_t vcount, uint32_t cache)
+{
+	std::vector<uint32_t> time(vcount, 0);
+	uint32_t s = cache + 1;
+	uint32_t miss = 0;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t v = index[i];
+
+		if (s - time[v] > cache)
+		{
+			time[v] = s++;
+			miss++;
+		}
+	}
+	return miss;
+}
+
+/*
+ * Tipsify (Sander, Nehab, Barczak 2007). Fans around vertices that are still
+ * in the cache and falls back to recently used vertices on dead ends. Every
+ * fall back starts a new cluster, cluster holds the first triangle of each.
+ */
+static void
+meshopt_tipsify(const uint32_t* index, uint32_t count, uint32_t vcount, std::vector<uint32_t>* out, std::vector<uint32_t>* cluster)
+{
+	const uint32_t tcount = count / 3;
+	std::vector<uint32_t> adjacency_first(vcount + 1, 0);
+	std::vector<uint32_t> adjacency(count);
+	std::vector<int32_t> live(vcount, 0);
+	std::vector<uint32_t> time(vcount, 0);
+	std::vector<uint8_t> emitted(tcount, 0);
+	std::vector<uint32_t> dead_end;
+	std::vector<uint32_t> candidate;
+	uint32_t s = MESHOPT_CACHE + 1;
+	uint32_t cursor = 0;
+	int64_t f = 0;
+
+	out->clear();
+	cluster->clear();
+	if (tcount == 0)
+	{
+		return;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		adjacency_first[index[i] + 1]++;
+		live[index[i]]++;
+	}
+	for (uint32_t v = 0; v < vcount; v++)
+	{
+		adjacency_first[v + 1] += adjacency_first[v];
+	}
+	{
+		std::vector<uint32_t> fill(adjacency_first.begin(), adjacency_first.end() - 1);
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			adjacency[fill[index[i]]++] = i / 3;
+		}
+	}
+
+	f = index[0];
+	cluster->push_back(0);
+	while (f >= 0)
+	{
+		int64_t next = -1;
+		int64_t best = -1;
+
+		candidate.clear();
+		for (uint32_t a = adjacency_first[f]; a < adjacency_first[f + 1]; a++)
+		{
+			uint32_t t = adjacency[a];
+
+			if (emitted[t])
+			{
+				continue;
+			}
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				uint32_t v = index[t * 3 + k];
+
+				out->push_back(v);
+				dead_end.push_back(v);
+				candidate.push_back(v);
+				live[v]--;
+				if (s - time[v] > MESHOPT_CACHE)
+				{
+					time[v] = s++;
+				}
+			}
+			emitted[t] = 1;
+		}
+
+		/* Prefer the candidate that stays in the cache longest. */
+		for (uint32_t v : candidate)
+		{
+			if (live[v] > 0)
+			{
+				int64_t priority = 0;
+
+				if (s - time[v] + 2 * live[v] <= MESHOPT_CACHE)
+				{
+					priority = s - time[v];
+				}
+				if (priority > best)
+				{
+					best = priority;
+					next = v;
+				}
+			}
+		}
+
+		/* Dead end, newest vertex with triangles left, else the next in order. */
+		if (next < 0)
+		{
+			while (!dead_end.empty() && next < 0)
+			{
+				uint32_t d = dead_end.back();
+
+				dead_end.pop_back();
+				if (live[d] > 0)
+				{
+					next = d;
+				}
+			}
+			while (next < 0 && cursor < vcount)
+			{
+				if (live[cursor] > 0)
+				{
+					next = cursor;
+				}
+				cursor++;
+			}
+			if (next >= 0 && out->size() / 3 < tcount)
+			{
+				cluster->push_back((uint32_t)(out->size() / 3));
+			}
+		}
+		f = next;
+	}
+}
+
+/*
+ * Fast overdraw ordering (Sander et al.): clusters facing away from the
+ * group's centroid are drawn first, since they are the likeliest occluders.
+ * Triangle order inside a cluster is kept, so is the cache behaviour.
+ */
+static void
+meshopt_overdraw(std::vector<uint32_t>* index, const std::vector<uint32_t>& cluster, const float* vertex)
+{
+	const uint32_t tcount = (uint32_t)(index->size() / 3);
+	std::vector<float> sort_key(cluster.size());
+	std::vector<uint32_t> order(cluster.size());
+	std::vector<uint32_t> out;
+	glm::vec3 centroid = { 0.0f, 0.0f, 0.0f };
+	float area = 0.0f;
+
+	auto position = [vertex](uint32_t v)
+	{
+		const float* p = vertex + (size_t)v * MESH_VERTEX_FLOATS;
+
+		return glm::vec3(p[0], p[1], p[2]);
+	};
+	/* Outward face normal, the authored normal decides the side (y is flipped like the positions). */
+	auto face_normal = [vertex, &position](const uint32_t* t)
+	{
+		glm::vec3 n = glm::cross(position(t[1]) - position(t[0]), position(t[2]) - position(t[0]));
+		glm::vec3 authored = { 0.0f, 0.0f, 0.0f };
+
+		for (uint32_t k = 0; k < 3; k++)
+		{
+			const float* p = vertex + (size_t)t[k] * MESH_VERTEX_FLOATS + 5;
+
+			authored += glm::vec3(p[0], -p[1], p[2]);
+		}
+		return (glm::dot(n, authored) < 0.0f ? -n : n);
+	};
+
+	if (cluster.size() < 2)
+	{
+		return;
+	}
+
+	for (uint32_t t = 0; t < tcount; t++)
+	{
+		const uint32_t* tri = &(*index)[t * 3];
+		float a = glm::length(face_normal(tri));
+
+		centroid += a * (position(tri[0]) + position(tri[1]) + position(tri[2])) / 3.0f;
+		area += a;
+	}
+	if (area > 0.0f)
+	{
+		centroid /= area;
+	}
+
+	for (uint32_t c = 0; c < cluster.size(); c++)
+	{
+		uint32_t last = (c + 1 < cluster.size() ? cluster[c + 1] : tcount);
+		glm::vec3 cluster_centroid = { 0.0f, 0.0f, 0.0f };
+		glm::vec3 cluster_normal = { 0.0f, 0.0f, 0.0f };
+		float cluster_area = 0.0f;
+
+		for (uint32_t t = cluster[c]; t < last; t++)
+		{
+			const uint32_t* tri = &(*index)[t * 3];
+			glm::vec3 n = face_normal(tri);
+			float a = glm::length(n);
+
+			cluster_centroid += a * (position(tri[0]) + position(tri[1]) + position(tri[2])) / 3.0f;
+			cluster_normal += n;
+			cluster_area += a;
+		}
+		if (cluster_area > 0.0f)
+		{
+			cluster_centroid /= cluster_area;
+		}
+		if (glm::length(cluster_normal) > 0.0f)
+		{
+			cluster_normal = glm::normalize(cluster_normal);
+		}
+		sort_key[c] = glm::dot(cluster_centroid - centroid, cluster_normal);
+		order[c] = c;
+	}
+
+	std::stable_sort(order.begin(), order.end(), [&sort_key](uint32_t a, uint32_t b) { return sort_key[a] > sort_key[b]; });
+	out.reserve(index->size());
+	for (uint32_t c : order)
+	{
+		uint32_t last = (c + 1 < cluster.size() ? cluster[c + 1] : tcount);
+
+		out.insert(out.end(), index->begin() + cluster[c] * 3, index->begin() + last * 3);
+	}
+	*index = std::move(out);
+}
+
+/*
+ * Renumbers vertices in order of first use so fetches walk the buffer forwards.
+ */
+static void
+meshopt_fetch(uint32_t* index, uint32_t count, float* vertex, uint32_t vcount)
+{
+	std::vector<uint32_t> remap(vcount, UINT32_MAX);
+	std::vector<float> out((size_t)vcount * MESH_VERTEX_FLOATS);
+	uint32_t next = 0;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (remap[index[i]] == UINT32_MAX)
+		{
+			remap[index[i]] = next++;
+		}
+		index[i] = remap[index[i]];
+	}
+	for (uint32_t v = 0; v < vcount; v++)
+	{
+		if (remap[v] == UINT32_MAX)
+		{
+			remap[v] = next++;
+		}
+		memcpy(&out[(size_t)remap[v] * MESH_VERTEX_FLOATS], vertex + (size_t)v * MESH_VERTEX_FLOATS, MESH_VERTEX_FLOATS * sizeof(float));
+	}
+	memcpy(vertex, out.data(), out.size() * sizeof(float));
+}
+
+/*
+ * Reorders triangles and vertices of every group for the post-transform
+ * cache, early-z and vertex fetch, and reports ACMR/ATVR before and after.
+ * Runs before the mesh cache is written, so cached loads get the result for free.
+ */
+void
+mesh_optimize(struct mesh* m, const char* path)
+{
+	std::vector<uint32_t> before(m->group.size()), after(m->group.size());
+	uint64_t triangles = 0, vertices = 0, miss_before = 0, miss_after = 0;
+
+	job_parallel((uint32_t)m->group.size(), [m, &before, &after](uint32_t i)
+	{
+		const struct mesh_group& g = m->group[i];
+		uint32_t* index = m->index.data() + g.ifirst;
+		float* vertex = m->vertex.data() + (size_t)g.vfirst * MESH_VERTEX_FLOATS;
+		std::vector<uint32_t> order, cluster;
+
+		before[i] = meshopt_transformed(index, g.icount, g.vcount, MESHOPT_CACHE);
+		meshopt_tipsify(index, g.icount, g.vcount, &order, &cluster);
+		meshopt_overdraw(&order, cluster, vertex);
+		memcpy(index, order.data(), order.size() * sizeof(uint32_t));
+		meshopt_fetch(index, g.icount, vertex, g.vcount);
+		after[i] = meshopt_transformed(index, g.icount, g.vcount, MESHOPT_CACHE);
+	});
+
+	for (uint32_t i = 0; i < m->group.size(); i++)
+	{
+		triangles += m->group[i].icount / 3;
+		vertices += m->group[i].vcount;
+		miss_before += before[i];
+		miss_after += after[i];
+	}
+	if (triangles > 0 && vertices > 0)
+	{
+		std::cout << path << ": ACMR " << (double)miss_before / triangles << " -> " << (double)miss_after / triangles
+			<< ", ATVR " << (double)miss_before / vertices << " -> " << (double)miss_after / vertices
+			<< " (" << MESHOPT_CACHE << " entry cache)" << std::endl;
+	}
+}
+
+/*
+ * Octahedral mapping of a direction to [-1, 1]^2, zero vectors map to +z.
+ */
+static glm::vec2
+meshopt_octahedral(glm::vec3 n)
+{
+	float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	glm::vec2 e;
+
+	if (l1 == 0.0f)
+	{
+		return glm::vec2(0.0f, 0.0f);
+	}
+	n /= l1;
+	e = glm::vec2(n.x, n.y);
+	if (n.z < 0.0f)
+	{
+		e.x = (1.0f - fabsf(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+		e.y = (1.0f - fabsf(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return e;
+}
+
+/*
+ * Bounding box of count float vertices, lo above hi when count is 0.
+ */
+void
+mesh_bounds(const float* vertex, uint32_t count, glm::vec3* lo, glm::vec3* hi)
+{
+	*lo = glm::vec3(FLT_MAX);
+	*hi = glm::vec3(-FLT_MAX);
+	for (uint32_t v = 0; v < count; v++)
+	{
+		const float* p = vertex + (size_t)v * MESH_VERTEX_FLOATS;
+
+		*lo = glm::min(*lo, glm::vec3(p[0], p[1], p[2]));
+		*hi = glm::max(*hi, glm::vec3(p[0], p[1], p[2]));
+	}
+}
+
+/*
+ * Packs count float vertices into the compact layout. Positions are
+ * quantized to their bounding box, decoded as position * scale + offset.
+ */
+void
+mesh_pack(struct mesh_vertex_packed* out, const float* vertex, uint32_t count, glm::vec3* offset, glm::vec3* scale)
+{
+	glm::vec3 lo, hi;
+
+	if (count == 0)
+	{
+		*offset = glm::vec3(0.0f);
+		*scale = glm::vec3(0.0f);
+		return;
+	}
+	mesh_bounds(vertex, count, &lo, &hi);
+	*offset = lo;
+	*scale = hi - lo;
+	mesh_pack_bounds(out, vertex, count, *offset, *scale);
+}
+
+/*
+ * Same as mesh_pack with the bounds given, for vertices sharing them with
+ * others. They must lie within offset and offset + scale.
+ */
+void
+mesh_pack_bounds(struct mesh_vertex_packed* out, const float* vertex, uint32_t count, glm::vec3 offset, glm::vec3 scale)
+{
+	glm::vec3 inverse;
+
+	for (uint32_t k = 0; k < 3; k++)
+	{
+		inverse[k] = (scale[k] > 0.0f ? 1.0f / scale[k] : 0.0f);
+	}
+
+	for (uint32_t v = 0; v < count; v++)
+	{
+		const float* p = vertex + (size_t)v * MESH_VERTEX_FLOATS;
+		const glm::vec3 normal = glm::vec3(p[5], p[6], p[7]);
+		const glm::vec3 tangent = glm::vec3(p[8], p[9], p[10]);
+		const glm::vec3 bitangent = glm::vec3(p[11], p[12], p[13]);
+		const glm::vec3 position = (glm::vec3(p[0], p[1], p[2]) - offset) * inverse;
+		struct mesh_vertex_packed& o = out[v];
+		glm::vec2 e;
+
+		for (uint32_t k = 0; k < 3; k++)
+		{
+			o.position[k] = glm::packUnorm1x16(position[k]);
+		}
+		/* Tangents live in position space, which has y flipped against the normals. */
+		o.position[3] = (glm::dot(glm::cross(normal * glm::vec3(1.0f, -1.0f, 1.0f), tangent), bitangent) < 0.0f ? 0 : 0xffff);
+		o.uv[0] = glm::packHalf1x16(p[3]);
+		o.uv[1] = glm::packHalf1x16(p[4]);
+		e = meshopt_octahedral(normal);
+		o.normal[0] = (int16_t)glm::packSnorm1x16(e.x);
+		o.normal[1] = (int16_t)glm::packSnorm1x16(e.y);
+		e = meshopt_octahedral(tangent);
+		o.tangent[0] = (int16_t)glm::packSnorm1x16(e.x);
+		o.tangent[1] = (int16_t)glm::packSnorm1x16(e.y);
+	}
+}
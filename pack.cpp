@@ -0,0 +1,222 @@
+#include "global.hpp"
+#include "pak.hpp"
+#include "job.hpp"
+#include "rom.hpp"
+#include <cstring>
+#include <filesystem>
+#include <thread>
+
+/*
+ * Asset packer. Every file under the given directories goes into one pak
+ * that rom_pak_open maps at startup, see pak.hpp for the layout.
+ *
+ * matf_pack [-store] [-o rom.pak] [directory]...
+ */
+
+struct pack_file
+{
+	std::string path;
+	struct rom_info info;
+	struct rom_file file;
+	std::vector<uint8_t> packed; /* Empty when stored. */
+};
+
+/*
+ * Chunk size table followed by the chunks, each compressed on its own.
+ */
+static void
+pack_compress(struct pack_file* f)
+{
+	const uint32_t chunks = (uint32_t)((f->file.size + PAK_CHUNK - 1) / PAK_CHUNK);
+	std::vector<std::vector<uint8_t>> chunk(chunks);
+	size_t size = (size_t)chunks * sizeof(uint32_t);
+
+	job_parallel(chunks, [f, &chunk](uint32_t i)
+	{
+		const size_t raw = std::min<size_t>(PAK_CHUNK, f->file.size - (size_t)i * PAK_CHUNK);
+
+		chunk[i].resize(pak_lz4_bound(raw));
+		chunk[i].resize(pak_lz4_compress(f->file.data + (size_t)i * PAK_CHUNK, raw, chunk[i].data()));
+	});
+	for (const std::vector<uint8_t>& c : chunk)
+	{
+		size += c.size();
+	}
+
+	/* Not worth a decompression unless it saves a tenth. */
+	if (size > f->file.size - f->file.size / 10)
+	{
+		return;
+	}
+	f->packed.resize(size);
+	size = (size_t)chunks * sizeof(uint32_t);
+	for (uint32_t i = 0; i < chunks; i++)
+	{
+		const uint32_t chunk_size = (uint32_t)chunk[i].size();
+
+		memcpy(f->packed.data() + (size_t)i * sizeof(uint32_t), &chunk_size, sizeof(chunk_size));
+		memcpy(f->packed.data() + size, chunk[i].data(), chunk_size);
+		size += chunk_size;
+	}
+}
+
+static void
+pack_pad(std::ofstream& out)
+{
+	static const char zero[PAK_ALIGN] = { };
+	const size_t at = (size_t)out.tellp();
+
+	out.write(zero, (PAK_ALIGN - at % PAK_ALIGN) % PAK_ALIGN);
+}
+
+int
+main(int argc, char** argv)
+{
+	std::vector<struct pack_file> file;
+	std::vector<struct pak_entry> entry;
+	std::vector<const char*> directory;
+	std::string strings;
+	struct pak_header header = { };
+	const char* out_path = "rom.pak";
+	std::string temp_path;
+	int store = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-store") == 0)
+		{
+			store = 1;
+		}
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+		{
+			out_path = argv[++i];
+		}
+		else
+		{
+			directory.push_back(argv[i]);
+		}
+	}
+	if (directory.empty())
+	{
+		directory.push_back("rom");
+	}
+
+	for (const char* d : directory)
+	{
+		std::error_code error;
+
+		for (std::filesystem::recursive_directory_iterator it(d, error), end; !error && it != end; it.increment(error))
+		{
+			std::string path = it->path().generic_string();
+
+			/* Program caches belong to the machine that wrote them. */
+			if (!it->is_regular_file() || it->path().extension() == ".tmp" || it->path().extension() == ".cache")
+			{
+				continue;
+			}
+			while (path.compare(0, 2, "./") == 0)
+			{
+				path.erase(0, 2);
+			}
+			file.push_back({ path, { }, { }, { } });
+		}
+		if (error)
+		{
+			std::cout << "Could not read " << d << ": " << error.message() << std::endl;
+			return 1;
+		}
+	}
+
+	/* rom_pak_find does a binary search, byte order like strcmp. */
+	std::sort(file.begin(), file.end(), [](const struct pack_file& a, const struct pack_file& b) { return a.path < b.path; });
+	file.erase(std::unique(file.begin(), file.end(), [](const struct pack_file& a, const struct pack_file& b) { return a.path == b.path; }), file.end());
+
+	for (struct pack_file& f : file)
+	{
+		if (rom_stat(f.path.c_str(), &f.info) || rom_map(&f.file, f.path.c_str()))
+		{
+			std::cout << "Could not read " << f.path << "." << std::endl;
+			return 1;
+		}
+	}
+	if (!store)
+	{
+		job_begin(std::max(1, (int)std::thread::hardware_concurrency()) - 1);
+		job_parallel((uint32_t)file.size(), [&file](uint32_t i)
+		{
+			if (file[i].file.size > 0)
+			{
+				pack_compress(&file[i]);
+			}
+		});
+		job_end();
+	}
+
+	header.magic = PAK_MAGIC;
+	header.version = PAK_VERSION;
+	header.count = (uint32_t)file.size();
+	entry.resize(file.size());
+	for (size_t i = 0; i < file.size(); i++)
+	{
+		entry[i].path = strings.size();
+		strings.append(file[i].path);
+		strings.push_back('\0');
+	}
+	header.string_size = strings.size();
+
+	{
+		uint64_t at = sizeof(header) + entry.size() * sizeof(struct pak_entry) + strings.size();
+
+		for (size_t i = 0; i < file.size(); i++)
+		{
+			at = (at + PAK_ALIGN - 1) / PAK_ALIGN * PAK_ALIGN;
+			entry[i].offset = at;
+			entry[i].raw_size = file[i].file.size;
+			entry[i].size = (file[i].packed.empty() ? file[i].file.size : file[i].packed.size());
+			entry[i].mtime = file[i].info.mtime;
+			entry[i].compression = (file[i].packed.empty() ? PAK_STORED : PAK_LZ4);
+			at += entry[i].size;
+		}
+	}
+
+	temp_path = std::string(out_path) + ".tmp";
+	{
+		std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+		uint64_t raw = 0, packed = 0;
+
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)entry.data(), entry.size() * sizeof(struct pak_entry));
+		out.write(strings.data(), strings.size());
+		for (size_t i = 0; i < file.size(); i++)
+		{
+			pack_pad(out);
+			if (file[i].packed.empty())
+			{
+				out.write((const char*)file[i].file.data, file[i].file.size);
+			}
+			else
+			{
+				out.write((const char*)file[i].packed.data(), file[i].packed.size());
+			}
+			raw += entry[i].raw_size;
+			packed += entry[i].size;
+			rom_unmap(&file[i].file);
+		}
+		if (!out)
+		{
+			out.close();
+			std::remove(temp_path.c_str());
+			std::cout << "Could not write " << out_path << "." << std::endl;
+			return 1;
+		}
+		std::cout << "Packed " << file.size() << " files, " << raw / 1024 << " KiB into " << packed / 1024 << " KiB." << std::endl;
+	}
+
+	std::remove(out_path);
+	if (std::rename(temp_path.c_str(), out_path) != 0)
+	{
+		std::remove(temp_path.c_str());
+		return 1;
+	}
+	return 0;
+}
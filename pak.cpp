@@ -0,0 +1,182 @@
+#include "global.hpp"
+#include "pak.hpp"
+#include <cstring>
+
+/*
+ * LZ4 block format: sequences of a token, literal length, literals, a 16 bit
+ * match offset and match length. The last 5 bytes are always literals and
+ * the last match starts at least 12 bytes before the end.
+ */
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MATCH_LIMIT 12
+#define LZ4_HASH_BITS 16
+
+static uint32_t
+lz4_read32(const uint8_t* p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static uint8_t*
+lz4_length(uint8_t* op, size_t length)
+{
+	while (length >= 255)
+	{
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = (uint8_t)length;
+	return op;
+}
+
+static uint8_t*
+lz4_sequence(uint8_t* op, const uint8_t* literal, size_t literals, size_t offset, size_t match)
+{
+	uint8_t* token = op++;
+
+	*token = (uint8_t)(std::min<size_t>(literals, 15) << 4);
+	if (literals >= 15)
+	{
+		op = lz4_length(op, literals - 15);
+	}
+	memcpy(op, literal, literals);
+	op += literals;
+	if (match == 0)
+	{
+		return op;
+	}
+	*op++ = (uint8_t)offset;
+	*op++ = (uint8_t)(offset >> 8);
+	*token |= (uint8_t)std::min<size_t>(match - LZ4_MIN_MATCH, 15);
+	if (match - LZ4_MIN_MATCH >= 15)
+	{
+		op = lz4_length(op, match - LZ4_MIN_MATCH - 15);
+	}
+	return op;
+}
+
+size_t
+pak_lz4_bound(size_t size)
+{
+	return size + size / 255 + 16;
+}
+
+/*
+ * Greedy compressor with one candidate per hash of 4 bytes. Returns the
+ * compressed size, out needs pak_lz4_bound(size) bytes.
+ */
+size_t
+pak_lz4_compress(const uint8_t* in, size_t size, uint8_t* out)
+{
+	std::vector<uint32_t> table((size_t)1 << LZ4_HASH_BITS, 0);
+	uint8_t* op = out;
+	size_t anchor = 0, i = 0;
+
+	while (size > LZ4_MATCH_LIMIT && i < size - LZ4_MATCH_LIMIT)
+	{
+		const uint32_t sequence = lz4_read32(in + i);
+		const uint32_t hash = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+		const size_t candidate = table[hash];
+		size_t match = LZ4_MIN_MATCH;
+
+		table[hash] = (uint32_t)i + 1;
+		if (candidate == 0 || i - (candidate - 1) > 65535 || lz4_read32(in + candidate - 1) != sequence)
+		{
+			i++;
+			continue;
+		}
+		while (i + match < size - LZ4_LAST_LITERALS && in[candidate - 1 + match] == in[i + match])
+		{
+			match++;
+		}
+		op = lz4_sequence(op, in + anchor, i - anchor, i - (candidate - 1), match);
+		i += match;
+		anchor = i;
+	}
+	op = lz4_sequence(op, in + anchor, size - anchor, 0, 0);
+	return (size_t)(op - out);
+}
+
+/*
+ * Returns 0 when in decompresses to exactly raw_size bytes.
+ */
+int
+pak_lz4_decompress(const uint8_t* in, size_t size, uint8_t* out, size_t raw_size)
+{
+	const uint8_t* ip = in;
+	const uint8_t* const iend = in + size;
+	uint8_t* op = out;
+	uint8_t* const oend = out + raw_size;
+
+	while (ip < iend)
+	{
+		const uint8_t token = *ip++;
+		size_t literals = token >> 4, match = token & 15, offset;
+
+		if (literals == 15)
+		{
+			uint8_t b;
+
+			do
+			{
+				if (ip >= iend)
+				{
+					return 1;
+				}
+				b = *ip++;
+				literals += b;
+			} while (b == 255);
+		}
+		if (literals > (size_t)(iend - ip) || literals > (size_t)(oend - op))
+		{
+			return 1;
+		}
+		memcpy(op, ip, literals);
+		op += literals;
+		ip += literals;
+		if (ip == iend)
+		{
+			break;
+		}
+
+		if (iend - ip < 2)
+		{
+			return 1;
+		}
+		offset = ip[0] | (size_t)ip[1] << 8;
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - out))
+		{
+			return 1;
+		}
+		if (match == 15)
+		{
+			uint8_t b;
+
+			do
+			{
+				if (ip >= iend)
+				{
+					return 1;
+				}
+				b = *ip++;
+				match += b;
+			} while (b == 255);
+		}
+		match += LZ4_MIN_MATCH;
+		if (match > (size_t)(oend - op))
+		{
+			return 1;
+		}
+		/* Overlapping copies repeat the pattern, byte by byte. */
+		for (size_t k = 0; k < match; k++, op++)
+		{
+			*op = *(op - offset);
+		}
+	}
+	return (op == oend ? 0 : 1);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+/*
+ * rom.pak: every file under rom/ in one file, opened with a single mapping.
+ *
+ * pak_header, then pak_entry[count] sorted by path, then the path strings,
+ * then the file data with every entry starting on a PAK_ALIGN boundary.
+ * Compressed entries are split into PAK_CHUNK sized pieces compressed on
+ * their own, so they can be decompressed in parallel; their data starts with
+ * the compressed size of each chunk as uint32_t.
+ */
+#define PAK_MAGIC 0x4b41504d /* "MPAK" */
+#define PAK_VERSION 1
+#define PAK_ALIGN 4096
+#define PAK_CHUNK (256 * 1024)
+
+enum pak_compression
+{
+	PAK_STORED,
+	PAK_LZ4,
+};
+
+struct pak_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;
+	uint32_t reserved;
+	uint64_t string_size;
+};
+
+struct pak_entry
+{
+	uint64_t path; /* Offset in the string table, '\0' terminated. */
+	uint64_t offset; /* From the start of the file. */
+	uint64_t size; /* Stored bytes. */
+	uint64_t raw_size;
+	int64_t mtime; /* Of the packed file, for derived file checks. */
+	uint32_t compression;
+	uint32_t reserved;
+};
+
+extern size_t pak_lz4_bound(size_t size);
+extern size_t pak_lz4_compress(const uint8_t* in, size_t size, uint8_t* out);
+extern int pak_lz4_decompress(const uint8_t* in, size_t size, uint8_t* out, size_t raw_size);
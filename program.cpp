@@ -0,0 +1,414 @@
+#include "global.hpp"
+#include "program.hpp"
+#include "rom.hpp"
+#include <chrono>
+#include <cstring>
+#include <memory>
+
+#define PROGRAM_CACHE_VERSION 1
+
+/*
+ * Program cache file: the header followed by size bytes of
+ * glGetProgramBinary output in format.
+ */
+struct program_cache_header
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	uint32_t format;
+	uint32_t size;
+};
+
+enum program_state
+{
+	PROGRAM_LINKING,
+	PROGRAM_READY,
+	PROGRAM_FAILED,
+	PROGRAM_RELEASED,
+};
+
+/*
+ * Shader modules are kept until the link is checked, so their logs can be
+ * reported.
+ */
+struct program_entry
+{
+	std::string name;
+	std::string cache_path; /* rom/program/<name>.<defines hash>.cache */
+	uint64_t key;
+	GLuint id;
+	GLuint module[2]; /* Vertex and fragment, 0 for a cached binary. */
+	enum program_state state;
+	std::chrono::steady_clock::time_point begin;
+};
+
+static struct
+{
+	int checked;
+	int binary; /* Driver can return and take program binaries. */
+	int parallel; /* Compiles and links run on driver threads, polled with GL_COMPLETION_STATUS_KHR. */
+	std::string driver; /* Vendor, renderer and version, part of the cache key. */
+	std::vector<struct program_entry> entry; /* Handle - 1. */
+} program_cache;
+
+static void
+program_cache_check(void)
+{
+	GLint formats = 0;
+
+	program_cache.checked = 1;
+#if defined(_WIN64) || defined(_WIN32)
+	program_cache.binary = (glGetProgramBinary != nullptr && glProgramBinary != nullptr && glProgramParameteri != nullptr);
+#else
+	program_cache.binary = GLEW_ARB_get_program_binary;
+#endif
+	if (program_cache.binary)
+	{
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		program_cache.binary = (formats > 0);
+	}
+	for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+	{
+		const GLubyte* s = glGetString(name);
+
+		program_cache.driver.append(s ? (const char*)s : "").push_back('\0');
+	}
+
+#if defined(_WIN64) || defined(_WIN32)
+	program_cache.parallel = (glMaxShaderCompilerThreadsKHR != nullptr);
+#else
+	program_cache.parallel = GLEW_KHR_parallel_shader_compile;
+#endif
+	if (program_cache.parallel)
+	{
+		/* As many threads as the driver wants. */
+		glMaxShaderCompilerThreadsKHR(0xffffffff);
+	}
+}
+
+/*
+ * Source of one stage with the defines inserted after the #version line.
+ */
+static std::string
+program_source(const char* path, const char* defines)
+{
+	struct rom_file file;
+	std::string source;
+
+	if (rom_map(&file, path) == 0)
+	{
+		source.assign((const char*)file.data, file.size);
+		rom_unmap(&file);
+	}
+	if (defines[0] != '\0')
+	{
+		size_t line = source.find('\n');
+
+		if (line != std::string::npos)
+		{
+			source.insert(line + 1, std::string(defines) + "#line 2\n");
+		}
+	}
+	return source;
+}
+
+static GLuint
+program_module_compile(GLenum type, const std::string& source)
+{
+	const char* csource = source.c_str();
+	GLuint shadermodule;
+
+	shadermodule = glCreateShader(type);
+	glShaderSource(shadermodule, 1, &csource, NULL);
+	glCompileShader(shadermodule);
+	return shadermodule;
+}
+
+/*
+ * A binary the driver rejects, from another driver build or GPU that the key
+ * did not catch, counts as a miss.
+ */
+static GLuint
+program_cache_load(const char* path, uint64_t key)
+{
+	struct program_cache_header header;
+	struct rom_file file;
+	GLuint program = 0;
+	GLint status = GL_FALSE;
+
+	if (rom_map(&file, path))
+	{
+		return 0;
+	}
+	if (file.size >= sizeof(header))
+	{
+		memcpy(&header, file.data, sizeof(header));
+		if (memcmp(header.magic, "PRGM", 4) == 0 && header.version == PROGRAM_CACHE_VERSION && header.key == key && header.size <= file.size - sizeof(header))
+		{
+			program = glCreateProgram();
+			glProgramBinary(program, header.format, file.data + sizeof(header), (GLsizei)header.size);
+			glGetProgramiv(program, GL_LINK_STATUS, &status);
+			if (status != GL_TRUE)
+			{
+				glDeleteProgram(program);
+				program = 0;
+			}
+		}
+	}
+	rom_unmap(&file);
+	return program;
+}
+
+/*
+ * Written to a temporary file first, like the mesh cache.
+ */
+static int
+program_cache_write(const char* path, uint64_t key, GLuint program)
+{
+	struct program_cache_header header = { };
+	std::vector<uint8_t> binary;
+	std::string temp_path = std::string(path) + ".tmp";
+	GLint size = 0;
+	GLsizei length = 0;
+	GLenum format = 0;
+
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+	if (size <= 0)
+	{
+		return 1;
+	}
+	binary.resize(size);
+	glGetProgramBinary(program, size, &length, &format, binary.data());
+	if (length <= 0)
+	{
+		return 1;
+	}
+	memcpy(header.magic, "PRGM", 4);
+	header.version = PROGRAM_CACHE_VERSION;
+	header.key = key;
+	header.format = format;
+	header.size = (uint32_t)length;
+
+	{
+		std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)binary.data(), length);
+		if (!out)
+		{
+			out.close();
+			std::remove(temp_path.c_str());
+			return 1;
+		}
+	}
+
+	std::remove(path);
+	if (std::rename(temp_path.c_str(), path) != 0)
+	{
+		std::remove(temp_path.c_str());
+		return 1;
+	}
+	return 0;
+}
+
+static float
+program_ms(const struct program_entry& e)
+{
+	return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - e.begin).count();
+}
+
+/*
+ * Prints the compile log of a module that failed, or the link log.
+ */
+static void
+program_report(const struct program_entry& e)
+{
+	static const char* stage[2] = { "_vert.glsl", "_frag.glsl" };
+	GLint status = GL_FALSE, length = 0;
+
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		glGetShaderiv(e.module[i], GL_COMPILE_STATUS, &status);
+		if (status == GL_TRUE)
+		{
+			continue;
+		}
+		glGetShaderiv(e.module[i], GL_INFO_LOG_LENGTH, &length);
+		std::unique_ptr<char[]> log(new char[std::max(length, 1)]());
+		glGetShaderInfoLog(e.module[i], std::max(length, 1), nullptr, log.get());
+		std::cout << "rom/program/" << e.name << stage[i] << " did not compile:" << std::endl << log.get() << std::endl;
+		return;
+	}
+	glGetProgramiv(e.id, GL_INFO_LOG_LENGTH, &length);
+	std::unique_ptr<char[]> log(new char[std::max(length, 1)]());
+	glGetProgramInfoLog(e.id, std::max(length, 1), nullptr, log.get());
+	std::cout << "Program " << e.name << " did not link:" << std::endl << log.get() << std::endl;
+}
+
+/*
+ * Link status of a finished entry, blocking unless the driver reported
+ * completion already. Writes the cache for a fresh link.
+ */
+static void
+program_finish(struct program_entry* e)
+{
+	GLint status = GL_FALSE;
+
+	glGetProgramiv(e->id, GL_LINK_STATUS, &status);
+	if (status != GL_TRUE)
+	{
+		program_report(*e);
+	}
+	else if (program_cache.binary)
+	{
+		program_cache_write(e->cache_path.c_str(), e->key, e->id);
+	}
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		glDetachShader(e->id, e->module[i]);
+		glDeleteShader(e->module[i]);
+		e->module[i] = 0;
+	}
+
+	if (status != GL_TRUE)
+	{
+		glDeleteProgram(e->id);
+		e->id = 0;
+		e->state = PROGRAM_FAILED;
+		return;
+	}
+	std::cout << "Program " << e->name << " compiled in " << program_ms(*e) << " ms." << std::endl;
+	e->state = PROGRAM_READY;
+}
+
+/*
+ * The cache file is named after the defines, the key hashes both sources
+ * after the defines went in, and the driver strings, so an edited shader or
+ * a driver update compiles again. Everything up to glLinkProgram is issued
+ * here, nothing waits for the compiler.
+ */
+uint32_t
+program_submit(const char* name, const char* defines)
+{
+	const std::string prefix = std::string("rom/program/") + name;
+	std::string vertex_source, fragment_source, key_source;
+	struct program_entry e = { };
+
+	if (!program_cache.checked)
+	{
+		program_cache_check();
+	}
+	e.name = name;
+	{
+		char hash[17];
+
+		/* Variants of one program keep their own file. */
+		snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)rom_hash(defines, strlen(defines)));
+		e.cache_path = prefix + "." + hash + ".cache";
+	}
+	e.begin = std::chrono::steady_clock::now();
+	vertex_source = program_source((prefix + "_vert.glsl").c_str(), defines);
+	fragment_source = program_source((prefix + "_frag.glsl").c_str(), defines);
+	key_source.append(vertex_source).push_back('\0');
+	key_source.append(fragment_source).push_back('\0');
+	key_source.append(program_cache.driver);
+	e.key = rom_hash(key_source.data(), key_source.size());
+
+	if (program_cache.binary)
+	{
+		e.id = program_cache_load(e.cache_path.c_str(), e.key);
+	}
+	if (e.id != 0)
+	{
+		std::cout << "Program " << name << " loaded from cache in " << program_ms(e) << " ms." << std::endl;
+		e.state = PROGRAM_READY;
+	}
+	else
+	{
+		e.module[0] = program_module_compile(GL_VERTEX_SHADER, vertex_source);
+		e.module[1] = program_module_compile(GL_FRAGMENT_SHADER, fragment_source);
+		e.id = glCreateProgram();
+		if (program_cache.binary)
+		{
+			glProgramParameteri(e.id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+		glAttachShader(e.id, e.module[0]);
+		glAttachShader(e.id, e.module[1]);
+		glLinkProgram(e.id);
+		e.state = PROGRAM_LINKING;
+	}
+	program_cache.entry.push_back(e);
+	return (uint32_t)program_cache.entry.size();
+}
+
+/*
+ * 0 while the program is linking or when it failed. With
+ * KHR_parallel_shader_compile this never waits for the compiler, without
+ * it the first call does.
+ */
+GLuint
+program_get(uint32_t handle)
+{
+	struct program_entry* e;
+
+	if (handle == 0 || handle > program_cache.entry.size())
+	{
+		return 0;
+	}
+	e = &program_cache.entry[handle - 1];
+	if (e->state == PROGRAM_LINKING)
+	{
+		GLint done = GL_TRUE;
+
+		if (program_cache.parallel)
+		{
+			glGetProgramiv(e->id, GL_COMPLETION_STATUS_KHR, &done);
+		}
+		if (done == GL_TRUE)
+		{
+			program_finish(e);
+		}
+	}
+	/* The id exists from glCreateProgram on, it is no use before the link is done. */
+	return (e->state == PROGRAM_READY ? e->id : 0);
+}
+
+/*
+ * Waits for the link, 0 when it failed.
+ */
+GLuint
+program_wait(uint32_t handle)
+{
+	if (handle == 0 || handle > program_cache.entry.size())
+	{
+		return 0;
+	}
+	if (program_cache.entry[handle - 1].state == PROGRAM_LINKING)
+	{
+		program_finish(&program_cache.entry[handle - 1]);
+	}
+	return program_cache.entry[handle - 1].id;
+}
+
+void
+program_release(uint32_t handle)
+{
+	struct program_entry* e;
+
+	if (handle == 0 || handle > program_cache.entry.size())
+	{
+		return;
+	}
+	e = &program_cache.entry[handle - 1];
+	if (e->state == PROGRAM_LINKING)
+	{
+		program_finish(e);
+	}
+	if (e->id != 0)
+	{
+		glDeleteProgram(e->id);
+		e->id = 0;
+	}
+	e->state = PROGRAM_RELEASED;
+}
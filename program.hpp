@@ -0,0 +1,21 @@
+#pragma once
+
+/*
+ * Links rom/program/<name>_vert.glsl and <name>_frag.glsl, defines are
+ * inserted after the #version line. The linked binary is kept in
+ * rom/program/<name>.<hash of the defines>.cache and loaded instead of
+ * compiling while the sources, defines and driver stay the same. It is
+ * written when program_get or program_wait first sees the link finished,
+ * so a program nobody asks for again is compiled on the next start too.
+ *
+ * Programs are submitted all at once and compile in the background where the
+ * driver has KHR_parallel_shader_compile. Handles are 0 for no program,
+ * program_get returns 0 until the program is linked, program_wait blocks
+ * for it. Compile and link errors are printed with the module they belong
+ * to. program_release deletes a program no longer drawn with, its handle
+ * returns 0 after.
+ */
+extern uint32_t program_submit(const char* name, const char* defines);
+extern GLuint program_get(uint32_t handle);
+extern GLuint program_wait(uint32_t handle);
+extern void program_release(uint32_t handle);
@@ -0,0 +1,69 @@
+#include "global.hpp"
+#include "queue.hpp"
+#include <cstring>
+
+/*
+ * Depth is the distance in front of the camera. Non-negative floats order
+ * like their bits, so the whole float is the lowest 32 bits of the key.
+ * Anything behind the camera sorts first.
+ */
+uint64_t
+queue_key(uint32_t pass, uint32_t program, uint32_t material, float depth)
+{
+	uint32_t bits;
+
+	depth = std::max(depth, 0.0f);
+	memcpy(&bits, &depth, sizeof(bits));
+	return ((uint64_t)(pass & 0xf) << QUEUE_PASS_SHIFT)
+		| ((uint64_t)(program & 0xff) << QUEUE_PROGRAM_SHIFT)
+		| ((uint64_t)std::min(material, QUEUE_MATERIAL_MAX) << QUEUE_MATERIAL_SHIFT)
+		| bits;
+}
+
+/*
+ * Radix sort by key, a byte per pass starting at the least significant one.
+ * Bytes every key shares are skipped, so a frame with one pass and program
+ * costs the depth and material bytes only. Stable, equal keys keep their
+ * push order.
+ */
+void
+queue_sort(struct queue* q)
+{
+	const size_t n = q->item.size();
+	uint32_t count[8][256] = { };
+
+	if (n < 2)
+	{
+		return;
+	}
+	for (const struct queue_item& it : q->item)
+	{
+		for (uint32_t b = 0; b < 8; b++)
+		{
+			count[b][(it.key >> (b * 8)) & 0xff]++;
+		}
+	}
+
+	q->scratch.resize(n);
+	for (uint32_t b = 0; b < 8; b++)
+	{
+		uint32_t offset = 0;
+
+		if (count[b][(q->item[0].key >> (b * 8)) & 0xff] == n)
+		{
+			continue;
+		}
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			const uint32_t c = count[b][i];
+
+			count[b][i] = offset;
+			offset += c;
+		}
+		for (const struct queue_item& it : q->item)
+		{
+			q->scratch[count[b][(it.key >> (b * 8)) & 0xff]++] = it;
+		}
+		q->item.swap(q->scratch);
+	}
+}
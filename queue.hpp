@@ -0,0 +1,26 @@
+#pragma once
+
+/*
+ * Draw sort key, most significant field first: pass, program, material and
+ * depth. Sorting the keys groups draws by state and puts the nearest first
+ * inside a group.
+ */
+#define QUEUE_PASS_SHIFT 60 /* 4 bits */
+#define QUEUE_PROGRAM_SHIFT 52 /* 8 bits */
+#define QUEUE_MATERIAL_SHIFT 32 /* 20 bits, material and texture set */
+#define QUEUE_MATERIAL_MAX ((1u << 20) - 1)
+
+struct queue_item
+{
+	uint64_t key;
+	uint32_t payload; /* What to draw, up to the user. */
+};
+
+struct queue
+{
+	std::vector<struct queue_item> item;
+	std::vector<struct queue_item> scratch;
+};
+
+extern uint64_t queue_key(uint32_t pass, uint32_t program, uint32_t material, float depth);
+extern void queue_sort(struct queue* q);
@@ -0,0 +1,137 @@
+#include "global.hpp"
+#include "ring.hpp"
+
+static int
+ring_persistent(void)
+{
+#if defined(_WIN64) || defined(_WIN32)
+	return (glBufferStorage != nullptr);
+#else
+	return GLEW_ARB_buffer_storage;
+#endif
+}
+
+uint32_t
+ring_align(void)
+{
+	static GLint align = 0;
+
+	if (align == 0)
+	{
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+		align = std::max(align, 16);
+	}
+	return (uint32_t)align;
+}
+
+/*
+ * size is rounded up so every region starts aligned.
+ */
+int
+ring_create(struct ring* r, uint32_t size)
+{
+	const uint32_t align = ring_align();
+
+	*r = { };
+	r->size = (size + align - 1) / align * align;
+	glGenBuffers(1, &r->buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, r->buffer);
+	if (ring_persistent())
+	{
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+		glBufferStorage(GL_UNIFORM_BUFFER, (GLsizeiptr)r->size * RING_FRAMES, nullptr, flags);
+		r->mapped = (uint8_t*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, (GLsizeiptr)r->size * RING_FRAMES, flags);
+	}
+	else
+	{
+		glBufferData(GL_UNIFORM_BUFFER, (GLsizeiptr)r->size * RING_FRAMES, nullptr, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	if (ring_persistent() && r->mapped == nullptr)
+	{
+		std::cout << "Uniform ring of " << r->size << " bytes could not be mapped." << std::endl;
+		ring_release(r);
+		return 1;
+	}
+	return 0;
+}
+
+void
+ring_release(struct ring* r)
+{
+	for (uint32_t i = 0; i < RING_FRAMES; i++)
+	{
+		if (r->fence[i])
+		{
+			glDeleteSync(r->fence[i]);
+		}
+	}
+	if (r->buffer)
+	{
+		/* Deleting the buffer unmaps it. */
+		glDeleteBuffers(1, &r->buffer);
+	}
+	*r = { };
+}
+
+/*
+ * Moves to the next region and returns it for writing, waiting for the GPU
+ * to finish the frame RING_FRAMES ago if it has not.
+ */
+uint8_t*
+ring_map(struct ring* r)
+{
+	GLsync* fence;
+
+	r->frame = (r->frame + 1) % RING_FRAMES;
+	fence = &r->fence[r->frame];
+	if (*fence)
+	{
+		GLenum status;
+
+		do
+		{
+			status = glClientWaitSync(*fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		} while (status == GL_TIMEOUT_EXPIRED);
+		glDeleteSync(*fence);
+		*fence = 0;
+	}
+
+	if (r->mapped)
+	{
+		return r->mapped + (size_t)r->size * r->frame;
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, r->buffer);
+	/* The fence was waited for, the driver need not. */
+	return (uint8_t*)glMapBufferRange(GL_UNIFORM_BUFFER, (GLintptr)r->size * r->frame, r->size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+}
+
+void
+ring_unmap(struct ring* r)
+{
+	if (r->mapped == nullptr)
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, r->buffer);
+		glUnmapBuffer(GL_UNIFORM_BUFFER);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+}
+
+void
+ring_bind(const struct ring* r, GLuint index, uint32_t offset, uint32_t size)
+{
+	glBindBufferRange(GL_UNIFORM_BUFFER, index, r->buffer, (GLintptr)r->size * r->frame + offset, size);
+}
+
+/*
+ * After the last draw reading the current region.
+ */
+void
+ring_fence(struct ring* r)
+{
+	if (r->fence[r->frame] == 0)
+	{
+		r->fence[r->frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#define RING_FRAMES 3
+
+/*
+ * Uniform buffer split into RING_FRAMES regions, one written per frame while
+ * the GPU may still read the two before it. A region is reused once the
+ * fence of the frame that last read it has signalled.
+ */
+struct ring
+{
+	GLuint buffer;
+	uint8_t* mapped; /* Whole buffer, persistently mapped, or nullptr. */
+	uint32_t size; /* Of one region. */
+	uint32_t frame;
+	GLsync fence[RING_FRAMES];
+};
+
+/*
+ * The buffer is mapped once and stays mapped where the driver has
+ * ARB_buffer_storage, otherwise each region is mapped by ring_map and
+ * unmapped by ring_unmap. Offsets given to ring_bind are relative to the
+ * region of the current frame and must be multiples of ring_align.
+ */
+extern uint32_t ring_align(void);
+extern int ring_create(struct ring* r, uint32_t size);
+extern void ring_release(struct ring* r);
+extern uint8_t* ring_map(struct ring* r);
+extern void ring_unmap(struct ring* r);
+extern void ring_bind(const struct ring* r, GLuint index, uint32_t offset, uint32_t size);
+extern void ring_fence(struct ring* r);
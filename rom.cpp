@@ -0,0 +1,351 @@
+#include "global.hpp"
+#include "rom.hpp"
+#include "pak.hpp"
+#include "job.hpp"
+#include <atomic>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if !defined(_WIN64) && !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+static struct
+{
+	struct rom_file file;
+	const struct pak_entry* entry;
+	const char* strings;
+	uint32_t count;
+} rom_pak;
+
+/*
+ * Map the whole file read-only. Empty files succeed with data set to nullptr.
+ */
+static int
+rom_map_file(struct rom_file* f, const char* path)
+{
+	*f = { };
+#if defined(_WIN64) || defined(_WIN32)
+	LARGE_INTEGER size;
+
+	f->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (f->file == INVALID_HANDLE_VALUE)
+	{
+		f->file = NULL;
+		return 1;
+	}
+	if (!GetFileSizeEx(f->file, &size))
+	{
+		rom_unmap(f);
+		return 1;
+	}
+	f->size = (size_t)size.QuadPart;
+	if (f->size == 0)
+	{
+		return 0;
+	}
+	f->mapping = CreateFileMappingA(f->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (f->mapping == NULL)
+	{
+		rom_unmap(f);
+		return 1;
+	}
+	f->data = (const uint8_t*)MapViewOfFile(f->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (f->data == NULL)
+	{
+		rom_unmap(f);
+		return 1;
+	}
+#else
+	struct stat st;
+	void* data;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return 1;
+	}
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return 1;
+	}
+	f->size = (size_t)st.st_size;
+	if (f->size == 0)
+	{
+		close(fd);
+		return 0;
+	}
+	data = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		*f = { };
+		return 1;
+	}
+	f->data = (const uint8_t*)data;
+#endif
+	return 0;
+}
+
+/*
+ * Map rom.pak and check its index, entries then take precedence over loose
+ * files with the same path.
+ */
+int
+rom_pak_open(const char* path)
+{
+	struct rom_file file;
+	struct pak_header header;
+	const struct pak_entry* entry;
+	size_t index_end;
+
+	if (rom_map_file(&file, path))
+	{
+		return 1;
+	}
+	if (file.size < sizeof(header))
+	{
+		rom_unmap(&file);
+		return 1;
+	}
+	memcpy(&header, file.data, sizeof(header));
+	index_end = sizeof(header) + (size_t)header.count * sizeof(struct pak_entry);
+	if (header.magic != PAK_MAGIC || header.version != PAK_VERSION || index_end > file.size || header.string_size > file.size - index_end
+	|| header.string_size == 0 || file.data[index_end + header.string_size - 1] != '\0')
+	{
+		std::cout << "Bad rom pak " << path << "." << std::endl;
+		rom_unmap(&file);
+		return 1;
+	}
+	entry = (const struct pak_entry*)(file.data + sizeof(header));
+	for (uint32_t i = 0; i < header.count; i++)
+	{
+		if (entry[i].path >= header.string_size || entry[i].offset > file.size || entry[i].size > file.size - entry[i].offset
+		|| (entry[i].compression == PAK_STORED && entry[i].size != entry[i].raw_size) || entry[i].compression > PAK_LZ4)
+		{
+			std::cout << "Bad rom pak " << path << "." << std::endl;
+			rom_unmap(&file);
+			return 1;
+		}
+	}
+
+	if (rom_pak.file.data)
+	{
+		rom_unmap(&rom_pak.file);
+	}
+	rom_pak.file = file;
+	rom_pak.entry = entry;
+	rom_pak.strings = (const char*)(file.data + index_end);
+	rom_pak.count = header.count;
+	std::cout << "Opened " << path << " with " << header.count << " files." << std::endl;
+	return 0;
+}
+
+/*
+ * Binary search of the pak index. Paths are compared with '/' separators and
+ * without a leading "./".
+ */
+static const struct pak_entry*
+rom_pak_find(const char* path)
+{
+	std::string key(path);
+	uint32_t lo = 0, hi = rom_pak.count;
+
+	std::replace(key.begin(), key.end(), '\\', '/');
+	while (key.compare(0, 2, "./") == 0)
+	{
+		key.erase(0, 2);
+	}
+	while (lo < hi)
+	{
+		const uint32_t mid = lo + (hi - lo) / 2;
+		const int c = strcmp(rom_pak.strings + rom_pak.entry[mid].path, key.c_str());
+
+		if (c == 0)
+		{
+			return &rom_pak.entry[mid];
+		}
+		if (c < 0)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	return nullptr;
+}
+
+/*
+ * Chunks were compressed independently, so they decompress in parallel into
+ * their own PAK_CHUNK slice of the output.
+ */
+static int
+rom_pak_decompress(const struct pak_entry* e, uint8_t* out)
+{
+	const uint8_t* data = rom_pak.file.data + e->offset;
+	const uint32_t chunks = (uint32_t)((e->raw_size + PAK_CHUNK - 1) / PAK_CHUNK);
+	std::vector<uint64_t> start(chunks + 1);
+	std::atomic<int> failed(0);
+
+	if ((uint64_t)chunks * sizeof(uint32_t) > e->size)
+	{
+		return 1;
+	}
+	start[0] = (uint64_t)chunks * sizeof(uint32_t);
+	for (uint32_t i = 0; i < chunks; i++)
+	{
+		uint32_t size;
+
+		memcpy(&size, data + (size_t)i * sizeof(uint32_t), sizeof(size));
+		start[i + 1] = start[i] + size;
+	}
+	if (start[chunks] != e->size)
+	{
+		return 1;
+	}
+	job_parallel(chunks, [&](uint32_t i)
+	{
+		const size_t raw = (size_t)std::min<uint64_t>(PAK_CHUNK, e->raw_size - (uint64_t)i * PAK_CHUNK);
+
+		if (pak_lz4_decompress(data + start[i], (size_t)(start[i + 1] - start[i]), out + (size_t)i * PAK_CHUNK, raw))
+		{
+			failed = 1;
+		}
+	});
+	return failed.load();
+}
+
+/*
+ * Files come from rom.pak when it is open and has them, otherwise they are
+ * mapped from disk.
+ */
+int
+rom_map(struct rom_file* f, const char* path)
+{
+	const struct pak_entry* e = (rom_pak.count ? rom_pak_find(path) : nullptr);
+	uint8_t* data;
+
+	if (e == nullptr)
+	{
+		return rom_map_file(f, path);
+	}
+	*f = { };
+	f->size = (size_t)e->raw_size;
+	if (f->size == 0)
+	{
+		f->source = ROM_PAK;
+		return 0;
+	}
+	if (e->compression == PAK_STORED)
+	{
+		f->data = rom_pak.file.data + e->offset;
+		f->source = ROM_PAK;
+		return 0;
+	}
+	data = (uint8_t*)malloc(f->size);
+	if (data == nullptr || rom_pak_decompress(e, data))
+	{
+		std::cout << "Could not decompress " << path << " from the rom pak." << std::endl;
+		free(data);
+		*f = { };
+		return 1;
+	}
+	f->data = data;
+	f->source = ROM_HEAP;
+	return 0;
+}
+
+void
+rom_unmap(struct rom_file* f)
+{
+	if (f->source == ROM_HEAP)
+	{
+		free((void*)f->data);
+		*f = { };
+		return;
+	}
+	if (f->source == ROM_PAK)
+	{
+		*f = { };
+		return;
+	}
+#if defined(_WIN64) || defined(_WIN32)
+	if (f->data)
+	{
+		UnmapViewOfFile(f->data);
+	}
+	if (f->mapping)
+	{
+		CloseHandle(f->mapping);
+	}
+	if (f->file)
+	{
+		CloseHandle(f->file);
+	}
+#else
+	if (f->data)
+	{
+		munmap((void*)f->data, f->size);
+	}
+#endif
+	*f = { };
+}
+
+/*
+ * Files in rom.pak report the size and modification time they were packed
+ * with.
+ */
+int
+rom_stat(const char* path, struct rom_info* info)
+{
+	const struct pak_entry* e = (rom_pak.count ? rom_pak_find(path) : nullptr);
+#if defined(_WIN64) || defined(_WIN32)
+	struct _stat64 st;
+#else
+	struct stat st;
+#endif
+
+	if (e)
+	{
+		info->size = e->raw_size;
+		info->mtime = e->mtime;
+		return 0;
+	}
+#if defined(_WIN64) || defined(_WIN32)
+	if (_stat64(path, &st) != 0)
+	{
+		return 1;
+	}
+#else
+	if (stat(path, &st) != 0)
+	{
+		return 1;
+	}
+#endif
+	info->size = (uint64_t)st.st_size;
+	info->mtime = (int64_t)st.st_mtime;
+	return 0;
+}
+
+/*
+ * FNV-1a, 64 bit.
+ */
+uint64_t
+rom_hash(const void* data, size_t size)
+{
+	const uint8_t* p = (const uint8_t*)data;
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= p[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+/* Where the bytes of a rom_file live. */
+enum rom_source
+{
+	ROM_MAPPED, /* Loose file mapping. */
+	ROM_PAK, /* Inside the rom.pak mapping. */
+	ROM_HEAP, /* Decompressed from rom.pak. */
+};
+
+/*
+ * Read-only view of a whole file mapped into memory.
+ */
+struct rom_file
+{
+	const uint8_t* data;
+	size_t size;
+	enum rom_source source;
+#if defined(_WIN64) || defined(_WIN32)
+	HANDLE file;
+	HANDLE mapping;
+#endif
+};
+
+/* Size and modification time used to invalidate derived files. */
+struct rom_info
+{
+	uint64_t size;
+	int64_t mtime;
+};
+
+extern int rom_pak_open(const char* path);
+extern int rom_map(struct rom_file* f, const char* path);
+extern void rom_unmap(struct rom_file* f);
+extern int rom_stat(const char* path, struct rom_info* info);
+extern uint64_t rom_hash(const void* data, size_t size);
@@ -9,7 +9,8 @@ uniform sampler2D imgtexture;
 void main()
 {
     colour = texture(imgtexture, uv);
-    if (colour.r == 0.0f && colour.g >= 1.0f && colour.b >= 1.0f)
+    // Baked images carry the colour key in alpha
+    if (colour.a < 0.5f || (colour.r == 0.0f && colour.g >= 1.0f && colour.b >= 1.0f))
     {
         discard;
     }
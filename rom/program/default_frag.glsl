@@ -9,16 +9,29 @@ in vec3 TangentDistantLightPos;
 
 out vec4 colour;
 
-uniform vec3 diffuse_in = vec3(0.6f, 0.6f, 0.6f);
-uniform vec3 ambient_in = vec3(0.0f, 0.0f, 0.0f);
-uniform vec4 specular_in = vec4(0.0f, 0.0f, 0.0f, 20.0f);
-uniform float transparency_in = 0.0f;
+struct material
+{
+    vec4 ambient; // w: transparency
+    vec4 diffuse;
+    vec4 specular; // a: shininess
+};
+
+layout (std140) uniform material_block
+{
+    material materials[MATERIAL_MAX];
+};
+
+uniform int material_index;
 uniform sampler2D imgtexture;
 uniform sampler2D normalmap;
 uniform sampler2D parallaxmap;
 
 void main()
 {
+    vec3 diffuse_in = materials[material_index].diffuse.rgb;
+    vec3 ambient_in = materials[material_index].ambient.rgb;
+    vec4 specular_in = materials[material_index].specular;
+    float transparency_in = materials[material_index].ambient.a;
     vec3 viewDir = normalize(TangentViewPos - TangentFragPos);
 
     //
@@ -33,8 +46,10 @@ void main()
         //discard;
     }
 
-    vec3 normal = texture(normalmap, new_uv).rgb;
-    normal = normalize(normal * 2.0 - 1.0);
+    // Normal maps store XY only
+    vec3 normal;
+    normal.xy = texture(normalmap, new_uv).rg * 2.0 - 1.0;
+    normal.z = sqrt(max(1.0 - dot(normal.xy, normal.xy), 0.0));
     
     //
     //
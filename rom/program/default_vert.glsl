@@ -1,10 +1,28 @@
 #version 330 core
 
+#ifdef VERTEX_PACKED
+layout (location = 0) in vec4 pos_;
+layout (location = 1) in vec2 uv_;
+layout (location = 2) in vec2 vnorm_;
+layout (location = 3) in vec2 vtangent_;
+
+uniform vec3 position_offset;
+uniform vec3 position_scale;
+
+vec3 octahedral(vec2 e)
+{
+    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-v.z, 0.0);
+    v.xy += vec2(v.x >= 0.0 ? -t : t, v.y >= 0.0 ? -t : t);
+    return normalize(v);
+}
+#else
 layout (location = 0) in vec3 pos;
 layout (location = 1) in vec2 uv_;
 layout (location = 2) in vec3 vnorm_;
 layout (location = 3) in vec3 vtangent_;
 layout (location = 4) in vec3 vbitangent_;
+#endif
 
 out vec2 uv;
 out vec3 fpos;
@@ -13,24 +31,40 @@ out vec3 TangentDistantLightPos;
 out vec3 TangentFragPos;
 out vec3 TangentViewPos;
 
-uniform mat4 mvp;
-uniform vec3 eye;
+layout (std140) uniform frame_block
+{
+    mat4 viewproj;
+    vec3 eye;
+    vec3 distant_light_dir;
+};
+
 uniform mat4 model;
-uniform vec3 distant_light_dir_in = vec3(32.0f, 8.0f, 1.0f);
 
 void main()
 {
+#ifdef VERTEX_PACKED
+    vec3 pos = pos_.xyz * position_scale + position_offset;
+    vec3 vnorm = octahedral(vnorm_);
+    vec3 vtangent = octahedral(vtangent_);
+    vec3 vbitangent = (pos_.w * 2.0 - 1.0) * cross(vnorm * vec3(1.0, -1.0, 1.0), vtangent);
+#else
+    vec3 vnorm = vnorm_;
+    vec3 vtangent = vtangent_;
+    vec3 vbitangent = vbitangent_;
+#endif
+
     uv = uv_;
     fpos = vec3(model * vec4(pos, 1.0));
 
-    vec3 T = normalize(mat3(model) * vtangent_);
-    vec3 B = normalize(mat3(model) * vbitangent_);
-    vec3 N = normalize(mat3(model) * vnorm_);
+    vec3 T = normalize(mat3(model) * vtangent);
+    vec3 B = normalize(mat3(model) * vbitangent);
+    vec3 N = normalize(mat3(model) * vnorm);
     mat3 TBN = transpose(mat3(T, B, N));
     TangentLightPos = TBN * vec3(eye.x, eye.y, eye.z);
     TangentViewPos  = TBN * vec3(eye.x, eye.y, eye.z);
     TangentFragPos  = TBN * fpos;
-    TangentDistantLightPos = TBN*distant_light_dir_in;
+    TangentDistantLightPos = TBN*distant_light_dir;
 
-    gl_Position = mvp*vec4(fpos, 1.0);
+    // Placed objects have always been moved by model twice.
+    gl_Position = viewproj*model*vec4(fpos, 1.0);
 }
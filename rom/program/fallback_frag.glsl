@@ -0,0 +1,27 @@
+#version 330 core
+
+in vec2 uv;
+
+out vec4 colour;
+
+struct material
+{
+    vec4 ambient; // w: transparency
+    vec4 diffuse;
+    vec4 specular; // a: shininess
+};
+
+layout (std140) uniform material_block
+{
+    material materials[MATERIAL_MAX];
+};
+
+uniform int material_index;
+uniform sampler2D imgtexture;
+
+// Unlit diffuse, stands in for default_frag.glsl while it compiles.
+void main()
+{
+    colour.rgb = materials[material_index].diffuse.rgb * texture(imgtexture, uv).rgb;
+    colour.a = 1.0 - materials[material_index].ambient.a;
+}
@@ -0,0 +1,33 @@
+#version 330 core
+
+#ifdef VERTEX_PACKED
+layout (location = 0) in vec4 pos_;
+
+uniform vec3 position_offset;
+uniform vec3 position_scale;
+#else
+layout (location = 0) in vec3 pos;
+#endif
+layout (location = 1) in vec2 uv_;
+
+out vec2 uv;
+
+layout (std140) uniform frame_block
+{
+    mat4 viewproj;
+    vec3 eye;
+    vec3 distant_light_dir;
+};
+
+uniform mat4 model;
+
+// Stands in for default_vert.glsl while it compiles.
+void main()
+{
+#ifdef VERTEX_PACKED
+    vec3 pos = pos_.xyz * position_scale + position_offset;
+#endif
+
+    uv = uv_;
+    gl_Position = viewproj * model * model * vec4(pos, 1.0);
+}
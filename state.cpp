@@ -0,0 +1,250 @@
+#include "global.hpp"
+#include "state.hpp"
+#include <cstring>
+#include <unordered_map>
+
+/* Not a valid name or value, the next call always goes to GL. */
+#define STATE_UNKNOWN 0xffffffffu
+
+/*
+ * Last value set at one uniform location, as bytes. Size 0 until the
+ * first call.
+ */
+struct state_uniform
+{
+	uint32_t size;
+	uint8_t value[16 * sizeof(float)];
+};
+
+static struct
+{
+	GLuint program;
+	GLuint vao;
+	uint32_t unit; /* Active texture unit. */
+	GLuint texture[STATE_UNITS][2]; /* 2D and cube map binding of each unit. */
+	GLenum front_face;
+	GLuint depth_mask;
+	std::unordered_map<GLuint, std::vector<struct state_uniform>> uniform; /* By program, then location. */
+	std::vector<struct state_uniform>* current; /* Uniforms of program. */
+	struct state_count count;
+} state;
+
+/*
+ * Texture uploads and buffer fills rebind textures and the vertex array,
+ * nothing outside the passes changes the program, so it and its uniforms
+ * are kept.
+ */
+void
+state_reset(void)
+{
+	state.vao = STATE_UNKNOWN;
+	state.unit = STATE_UNKNOWN;
+	for (uint32_t i = 0; i < STATE_UNITS; i++)
+	{
+		state.texture[i][0] = STATE_UNKNOWN;
+		state.texture[i][1] = STATE_UNKNOWN;
+	}
+	state.front_face = STATE_UNKNOWN;
+	state.depth_mask = STATE_UNKNOWN;
+}
+
+/*
+ * Once per frame, before the first draw. Everything outside the render
+ * passes (uploads, scene loading) may have changed the bindings.
+ */
+void
+state_begin(void)
+{
+	state_reset();
+	state.program = STATE_UNKNOWN;
+	state.current = nullptr;
+	state.count = { };
+}
+
+struct state_count
+state_count(void)
+{
+	return state.count;
+}
+
+/*
+ * 1 when value differs from what the slot holds, which then takes value.
+ */
+static int
+state_set(uint32_t* slot, uint32_t value)
+{
+	if (*slot == value)
+	{
+		state.count.skipped++;
+		return 0;
+	}
+	*slot = value;
+	state.count.issued++;
+	return 1;
+}
+
+void
+state_program(GLuint program)
+{
+	if (state_set(&state.program, program))
+	{
+		glUseProgram(program);
+		state.current = &state.uniform[program];
+	}
+}
+
+void
+state_forget(GLuint program)
+{
+	if (state.program == program)
+	{
+		state.program = STATE_UNKNOWN;
+		state.current = nullptr;
+	}
+	state.uniform.erase(program);
+}
+
+void
+state_vao(GLuint vao)
+{
+	if (state_set(&state.vao, vao))
+	{
+		glBindVertexArray(vao);
+	}
+}
+
+/*
+ * Unit is counted from 0, like the sampler uniforms.
+ */
+void
+state_texture(uint32_t unit, GLenum target, GLuint texture)
+{
+	if (unit >= STATE_UNITS)
+	{
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(target, texture);
+		state.unit = STATE_UNKNOWN;
+		state.count.issued += 2;
+		return;
+	}
+	if (!state_set(&state.texture[unit][target == GL_TEXTURE_CUBE_MAP], texture))
+	{
+		return;
+	}
+	if (state_set(&state.unit, unit))
+	{
+		glActiveTexture(GL_TEXTURE0 + unit);
+	}
+	glBindTexture(target, texture);
+}
+
+void
+state_front_face(GLenum mode)
+{
+	if (state_set(&state.front_face, mode))
+	{
+		glFrontFace(mode);
+	}
+}
+
+void
+state_depth_mask(GLboolean flag)
+{
+	if (state_set(&state.depth_mask, flag))
+	{
+		glDepthMask(flag);
+	}
+}
+
+/*
+ * 1 when the uniform of the current program at location does not hold
+ * value yet, which it is assumed to hold afterwards.
+ */
+static int
+state_uniform(GLint location, const void* value, uint32_t size)
+{
+	struct state_uniform* u;
+
+	/* Not in the program, GL would ignore it. */
+	if (location < 0)
+	{
+		state.count.skipped++;
+		return 0;
+	}
+	if (state.current == nullptr)
+	{
+		GLint program = 0;
+
+		/* No state_program yet this frame, the value belongs to whatever is bound. */
+		glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+		state.current = &state.uniform[(GLuint)program];
+	}
+	if ((size_t)location >= state.current->size())
+	{
+		state.current->resize(location + 1);
+	}
+	u = &(*state.current)[location];
+	if (u->size == size && memcmp(u->value, value, size) == 0)
+	{
+		state.count.skipped++;
+		return 0;
+	}
+	u->size = size;
+	memcpy(u->value, value, size);
+	state.count.issued++;
+	return 1;
+}
+
+void
+state_uniform1i(GLint location, GLint v)
+{
+	if (state_uniform(location, &v, sizeof(v)))
+	{
+		glUniform1i(location, v);
+	}
+}
+
+void
+state_uniform1f(GLint location, GLfloat v)
+{
+	if (state_uniform(location, &v, sizeof(v)))
+	{
+		glUniform1f(location, v);
+	}
+}
+
+void
+state_uniform2fv(GLint location, const GLfloat* v)
+{
+	if (state_uniform(location, v, 2 * sizeof(GLfloat)))
+	{
+		glUniform2fv(location, 1, v);
+	}
+}
+
+void
+state_uniform3fv(GLint location, const GLfloat* v)
+{
+	if (state_uniform(location, v, 3 * sizeof(GLfloat)))
+	{
+		glUniform3fv(location, 1, v);
+	}
+}
+
+void
+state_uniform4fv(GLint location, const GLfloat* v)
+{
+	if (state_uniform(location, v, 4 * sizeof(GLfloat)))
+	{
+		glUniform4fv(location, 1, v);
+	}
+}
+
+void
+state_uniform_matrix4fv(GLint location, const GLfloat* v)
+{
+	if (state_uniform(location, v, 16 * sizeof(GLfloat)))
+	{
+		glUniformMatrix4fv(location, 1, GL_FALSE, v);
+	}
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#define STATE_UNITS 4
+
+/* Calls that went to GL and calls that were dropped since state_begin. */
+struct state_count
+{
+	uint32_t issued;
+	uint32_t skipped;
+};
+
+/*
+ * Shadow of the GL state the render passes change, calls that would not
+ * change it are dropped. Bindings are forgotten by state_begin, code that
+ * binds textures or vertex arrays behind its back in between calls
+ * state_reset, which keeps the program. Uniform values are remembered per
+ * program and location, only state_uniform may set them. state_forget drops
+ * them for a program about to be deleted, whose name GL may hand out again.
+ */
+extern void state_begin(void);
+extern void state_reset(void);
+extern struct state_count state_count(void);
+extern void state_program(GLuint program);
+extern void state_forget(GLuint program);
+extern void state_vao(GLuint vao);
+extern void state_texture(uint32_t unit, GLenum target, GLuint texture);
+extern void state_front_face(GLenum mode);
+extern void state_depth_mask(GLboolean flag);
+extern void state_uniform1i(GLint location, GLint v);
+extern void state_uniform1f(GLint location, GLfloat v);
+extern void state_uniform2fv(GLint location, const GLfloat* v);
+extern void state_uniform3fv(GLint location, const GLfloat* v);
+extern void state_uniform4fv(GLint location, const GLfloat* v);
+extern void state_uniform_matrix4fv(GLint location, const GLfloat* v);
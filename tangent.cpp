@@ -0,0 +1,286 @@
+#include "global.hpp"
+#include "mesh.hpp"
+#include "job.hpp"
+#include <chrono>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TANGENT_SSE
+#endif
+
+/*
+ * Per group structure of arrays. Normals have y flipped like the positions,
+ * so everything here lives in the same space.
+ */
+struct tangent_soa
+{
+	std::vector<float> px, py, pz;
+	std::vector<float> u, v;
+	std::vector<float> nx, ny, nz;
+	std::vector<float> tx, ty, tz; /* Accumulated, then final tangent. */
+	std::vector<float> bx, by, bz; /* Accumulated, then final bitangent. */
+	std::vector<float> ftx, fty, ftz; /* Per face. */
+	std::vector<float> fbx, fby, fbz;
+};
+
+/*
+ * Unnormalized face tangent and bitangent (dP/du, dP/dv). Faces with
+ * degenerate uvs get zero.
+ */
+static void
+tangent_faces(struct tangent_soa* s, const uint32_t* index, uint32_t tcount)
+{
+	uint32_t f = 0;
+
+#if defined(TANGENT_SSE)
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	for (; f + 4 <= tcount; f += 4)
+	{
+		const uint32_t* t = index + f * 3;
+#define GATHER(a, k) _mm_set_ps(s->a[t[9 + k]], s->a[t[6 + k]], s->a[t[3 + k]], s->a[t[k]])
+		const __m128 x0 = GATHER(px, 0), y0 = GATHER(py, 0), z0 = GATHER(pz, 0);
+		const __m128 u0 = GATHER(u, 0), v0 = GATHER(v, 0);
+		const __m128 e1x = _mm_sub_ps(GATHER(px, 1), x0), e1y = _mm_sub_ps(GATHER(py, 1), y0), e1z = _mm_sub_ps(GATHER(pz, 1), z0);
+		const __m128 e2x = _mm_sub_ps(GATHER(px, 2), x0), e2y = _mm_sub_ps(GATHER(py, 2), y0), e2z = _mm_sub_ps(GATHER(pz, 2), z0);
+		const __m128 d1u = _mm_sub_ps(GATHER(u, 1), u0), d1v = _mm_sub_ps(GATHER(v, 1), v0);
+		const __m128 d2u = _mm_sub_ps(GATHER(u, 2), u0), d2v = _mm_sub_ps(GATHER(v, 2), v0);
+#undef GATHER
+		const __m128 det = _mm_sub_ps(_mm_mul_ps(d1u, d2v), _mm_mul_ps(d2u, d1v));
+		const __m128 r = _mm_and_ps(_mm_div_ps(one, det), _mm_cmpneq_ps(det, zero));
+		const __m128 a = _mm_mul_ps(r, d2v), b = _mm_mul_ps(r, d1v);
+		const __m128 c = _mm_mul_ps(r, d1u), d = _mm_mul_ps(r, d2u);
+
+		_mm_storeu_ps(&s->ftx[f], _mm_sub_ps(_mm_mul_ps(a, e1x), _mm_mul_ps(b, e2x)));
+		_mm_storeu_ps(&s->fty[f], _mm_sub_ps(_mm_mul_ps(a, e1y), _mm_mul_ps(b, e2y)));
+		_mm_storeu_ps(&s->ftz[f], _mm_sub_ps(_mm_mul_ps(a, e1z), _mm_mul_ps(b, e2z)));
+		_mm_storeu_ps(&s->fbx[f], _mm_sub_ps(_mm_mul_ps(c, e2x), _mm_mul_ps(d, e1x)));
+		_mm_storeu_ps(&s->fby[f], _mm_sub_ps(_mm_mul_ps(c, e2y), _mm_mul_ps(d, e1y)));
+		_mm_storeu_ps(&s->fbz[f], _mm_sub_ps(_mm_mul_ps(c, e2z), _mm_mul_ps(d, e1z)));
+	}
+#endif
+	for (; f < tcount; f++)
+	{
+		const uint32_t* t = index + f * 3;
+		const glm::vec3 p0 = { s->px[t[0]], s->py[t[0]], s->pz[t[0]] };
+		const glm::vec3 e1 = glm::vec3(s->px[t[1]], s->py[t[1]], s->pz[t[1]]) - p0;
+		const glm::vec3 e2 = glm::vec3(s->px[t[2]], s->py[t[2]], s->pz[t[2]]) - p0;
+		const glm::vec2 d1 = { s->u[t[1]] - s->u[t[0]], s->v[t[1]] - s->v[t[0]] };
+		const glm::vec2 d2 = { s->u[t[2]] - s->u[t[0]], s->v[t[2]] - s->v[t[0]] };
+		const float det = d1.x * d2.y - d2.x * d1.y;
+		const float r = (det != 0.0f ? 1.0f / det : 0.0f);
+		const glm::vec3 tangent = (r * d2.y) * e1 - (r * d1.y) * e2;
+		const glm::vec3 bitangent = (r * d1.x) * e2 - (r * d2.x) * e1;
+
+		s->ftx[f] = tangent.x;
+		s->fty[f] = tangent.y;
+		s->ftz[f] = tangent.z;
+		s->fbx[f] = bitangent.x;
+		s->fby[f] = bitangent.y;
+		s->fbz[f] = bitangent.z;
+	}
+}
+
+/*
+ * Face tangents projected into each corner's tangent plane, normalized and
+ * weighted by the corner angle, as MikkTSpace does.
+ */
+static void
+tangent_accumulate(struct tangent_soa* s, const uint32_t* index, uint32_t tcount)
+{
+	for (uint32_t f = 0; f < tcount; f++)
+	{
+		const uint32_t* t = index + f * 3;
+		const glm::vec3 ft = { s->ftx[f], s->fty[f], s->ftz[f] };
+		const glm::vec3 fb = { s->fbx[f], s->fby[f], s->fbz[f] };
+		glm::vec3 p[3];
+
+		if (ft == glm::vec3(0.0f) && fb == glm::vec3(0.0f))
+		{
+			continue;
+		}
+		for (uint32_t k = 0; k < 3; k++)
+		{
+			p[k] = glm::vec3(s->px[t[k]], s->py[t[k]], s->pz[t[k]]);
+		}
+		for (uint32_t k = 0; k < 3; k++)
+		{
+			const uint32_t i = t[k];
+			const glm::vec3 n = { s->nx[i], s->ny[i], s->nz[i] };
+			glm::vec3 e1 = p[(k + 1) % 3] - p[k];
+			glm::vec3 e2 = p[(k + 2) % 3] - p[k];
+			glm::vec3 tangent = ft - n * glm::dot(n, ft);
+			glm::vec3 bitangent = fb - n * glm::dot(n, fb);
+			float angle;
+
+			if (glm::dot(e1, e1) == 0.0f || glm::dot(e2, e2) == 0.0f)
+			{
+				continue;
+			}
+			angle = acosf(glm::clamp(glm::dot(glm::normalize(e1), glm::normalize(e2)), -1.0f, 1.0f));
+			if (glm::dot(tangent, tangent) > 0.0f)
+			{
+				tangent = glm::normalize(tangent) * angle;
+			}
+			if (glm::dot(bitangent, bitangent) > 0.0f)
+			{
+				bitangent = glm::normalize(bitangent) * angle;
+			}
+			s->tx[i] += tangent.x;
+			s->ty[i] += tangent.y;
+			s->tz[i] += tangent.z;
+			s->bx[i] += bitangent.x;
+			s->by[i] += bitangent.y;
+			s->bz[i] += bitangent.z;
+		}
+	}
+
+	/* No usable uvs, any direction in the tangent plane will do. */
+	for (uint32_t i = 0; i < s->tx.size(); i++)
+	{
+		if (s->tx[i] == 0.0f && s->ty[i] == 0.0f && s->tz[i] == 0.0f)
+		{
+			const glm::vec3 n = { s->nx[i], s->ny[i], s->nz[i] };
+			const glm::vec3 t = glm::cross(n, (fabsf(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f)));
+
+			s->tx[i] = t.x;
+			s->ty[i] = t.y;
+			s->tz[i] = t.z;
+		}
+	}
+}
+
+/*
+ * Gram-Schmidt against the normal, the bitangent becomes sign * cross(n, t)
+ * with the sign taken from the accumulated bitangent.
+ */
+static void
+tangent_orthonormalize(struct tangent_soa* s)
+{
+	const uint32_t count = (uint32_t)s->tx.size();
+	uint32_t i = 0;
+
+#if defined(TANGENT_SSE)
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 tiny = _mm_set1_ps(1e-30f);
+	const __m128 sign_bit = _mm_set1_ps(-0.0f);
+
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m128 nx = _mm_loadu_ps(&s->nx[i]), ny = _mm_loadu_ps(&s->ny[i]), nz = _mm_loadu_ps(&s->nz[i]);
+		__m128 tx = _mm_loadu_ps(&s->tx[i]), ty = _mm_loadu_ps(&s->ty[i]), tz = _mm_loadu_ps(&s->tz[i]);
+		const __m128 bx = _mm_loadu_ps(&s->bx[i]), by = _mm_loadu_ps(&s->by[i]), bz = _mm_loadu_ps(&s->bz[i]);
+		__m128 d, l, cx, cy, cz, flip;
+
+		d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, tx), _mm_mul_ps(ny, ty)), _mm_mul_ps(nz, tz));
+		tx = _mm_sub_ps(tx, _mm_mul_ps(nx, d));
+		ty = _mm_sub_ps(ty, _mm_mul_ps(ny, d));
+		tz = _mm_sub_ps(tz, _mm_mul_ps(nz, d));
+		l = _mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, tx), _mm_mul_ps(ty, ty)), _mm_mul_ps(tz, tz));
+		l = _mm_div_ps(one, _mm_sqrt_ps(_mm_max_ps(l, tiny)));
+		tx = _mm_mul_ps(tx, l);
+		ty = _mm_mul_ps(ty, l);
+		tz = _mm_mul_ps(tz, l);
+
+		cx = _mm_sub_ps(_mm_mul_ps(ny, tz), _mm_mul_ps(nz, ty));
+		cy = _mm_sub_ps(_mm_mul_ps(nz, tx), _mm_mul_ps(nx, tz));
+		cz = _mm_sub_ps(_mm_mul_ps(nx, ty), _mm_mul_ps(ny, tx));
+		d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, bx), _mm_mul_ps(cy, by)), _mm_mul_ps(cz, bz));
+		flip = _mm_and_ps(_mm_cmplt_ps(d, zero), sign_bit);
+
+		_mm_storeu_ps(&s->tx[i], tx);
+		_mm_storeu_ps(&s->ty[i], ty);
+		_mm_storeu_ps(&s->tz[i], tz);
+		_mm_storeu_ps(&s->bx[i], _mm_xor_ps(cx, flip));
+		_mm_storeu_ps(&s->by[i], _mm_xor_ps(cy, flip));
+		_mm_storeu_ps(&s->bz[i], _mm_xor_ps(cz, flip));
+	}
+#endif
+	for (; i < count; i++)
+	{
+		const glm::vec3 n = { s->nx[i], s->ny[i], s->nz[i] };
+		glm::vec3 t = { s->tx[i], s->ty[i], s->tz[i] };
+		glm::vec3 b;
+
+		t -= n * glm::dot(n, t);
+		t /= sqrtf(std::max(glm::dot(t, t), 1e-30f));
+		b = glm::cross(n, t);
+		if (glm::dot(b, glm::vec3(s->bx[i], s->by[i], s->bz[i])) < 0.0f)
+		{
+			b = -b;
+		}
+		s->tx[i] = t.x;
+		s->ty[i] = t.y;
+		s->tz[i] = t.z;
+		s->bx[i] = b.x;
+		s->by[i] = b.y;
+		s->bz[i] = b.z;
+	}
+}
+
+/*
+ * Smooth tangent space for welded vertices, groups run in parallel. Corners
+ * that only differ in tangent space share a vertex, seams need distinct
+ * uvs or normals.
+ */
+void
+mesh_tangents(struct mesh* m)
+{
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+	job_parallel((uint32_t)m->group.size(), [m](uint32_t g)
+	{
+		const struct mesh_group& group = m->group[g];
+		float* vertex = m->vertex.data() + (size_t)group.vfirst * MESH_VERTEX_FLOATS;
+		const uint32_t* index = m->index.data() + group.ifirst;
+		const uint32_t tcount = group.icount / 3;
+		struct tangent_soa s;
+
+		for (std::vector<float>* a : { &s.px, &s.py, &s.pz, &s.u, &s.v, &s.nx, &s.ny, &s.nz, &s.tx, &s.ty, &s.tz, &s.bx, &s.by, &s.bz })
+		{
+			a->resize(group.vcount, 0.0f);
+		}
+		for (std::vector<float>* a : { &s.ftx, &s.fty, &s.ftz, &s.fbx, &s.fby, &s.fbz })
+		{
+			a->resize(tcount);
+		}
+		for (uint32_t i = 0; i < group.vcount; i++)
+		{
+			const float* p = vertex + (size_t)i * MESH_VERTEX_FLOATS;
+			glm::vec3 n = { p[5], -p[6], p[7] };
+
+			if (glm::dot(n, n) > 0.0f)
+			{
+				n = glm::normalize(n);
+			}
+			s.px[i] = p[0];
+			s.py[i] = p[1];
+			s.pz[i] = p[2];
+			s.u[i] = p[3];
+			s.v[i] = p[4];
+			s.nx[i] = n.x;
+			s.ny[i] = n.y;
+			s.nz[i] = n.z;
+		}
+
+		tangent_faces(&s, index, tcount);
+		tangent_accumulate(&s, index, tcount);
+		tangent_orthonormalize(&s);
+
+		for (uint32_t i = 0; i < group.vcount; i++)
+		{
+			float* p = vertex + (size_t)i * MESH_VERTEX_FLOATS;
+
+			p[8] = s.tx[i];
+			p[9] = s.ty[i];
+			p[10] = s.tz[i];
+			p[11] = s.bx[i];
+			p[12] = s.by[i];
+			p[13] = s.bz[i];
+		}
+	});
+
+	std::cout << "tangents for " << m->vertex.size() / MESH_VERTEX_FLOATS << " vertices in "
+		<< std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count() << " ms" << std::endl;
+}
@@ -0,0 +1,1206 @@
+#include "global.hpp"
+#include "texture.hpp"
+#include "dds.hpp"
+#include "job.hpp"
+#include "jpeg.hpp"
+#include "rom.hpp"
+#include "stb_image.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+/* Upper bound for one pixel unpack buffer copy. */
+#define TEX_SLICE_BYTES (4 * 1024 * 1024)
+/* Levels up to this size stay resident for every referenced texture. */
+#define TEX_FLOOR 256
+/* How long the plan must ask for another level before it is uploaded. */
+#define TEX_DWELL_MS 500
+
+enum tex_state
+{
+	TEX_DECODING,
+	TEX_READY, /* Levels in memory, resident or not. */
+	TEX_UPLOADING,
+	TEX_FENCED,
+	TEX_BROKEN, /* Decode failed, not reported yet. */
+	TEX_FAILED,
+};
+
+/*
+ * Decoded levels, described by dds like a baked file. Levels finer than
+ * first are not kept.
+ */
+struct tex_chain
+{
+	std::vector<uint8_t> mip;
+	struct dds_image dds = { };
+	uint32_t first = 0;
+	int channels = 3;
+};
+
+/*
+ * One texture per distinct file content. The mapped file and levels belong
+ * to the decoding job until state becomes TEX_READY, after that to the
+ * render thread, as does refined once refine is 2. A baked file stays
+ * mapped. Decoded levels finer than TEX_FLOOR are freed once uploaded and
+ * decoded again, scaled, when the plan wants them back. A new plan is
+ * built into a second texture which replaces the sampled one once the GPU
+ * is done with it. Unreferenced entries stay resident until the
+ * budget needs their memory. The same file loaded as colour and as normal
+ * map gets two entries.
+ */
+struct tex_entry
+{
+	std::string path;
+	enum tex_kind kind = TEX_COLOUR;
+	uint32_t shift = 0; /* Finest level loaded, log2 of the tex_load scale. */
+	std::vector<std::string> alias; /* Every resolved path sharing this entry. */
+	uint64_t hash = 0;
+	int refs = 0;
+	uint64_t used = 0; /* Frame of the last tex_get. */
+	struct rom_file file = { };
+	std::atomic<int> state = { TEX_DECODING };
+	std::vector<uint8_t> mip; /* Decoded levels one after another. */
+	int w = 0, h = 0;
+	int channels = 3; /* Of the decoded levels, normal maps keep only XY. */
+	int format = -1; /* dds_format of a baked file, -1 for decoded levels. */
+	struct dds_image dds = { }; /* Levels of the baked file or of mip. */
+	uint32_t first = 0; /* Finest level in memory. */
+	uint32_t finest = 0; /* Finest level the file gives, see tex_load. */
+	struct tex_chain refined; /* Levels decoded again for a finer plan. */
+	std::atomic<int> refine = { 0 }; /* 1 while decoding, 2 once refined is done. */
+	float want = 0.0f; /* Texels across needed this frame, see tex_want. */
+	float coverage = 0.0f; /* Screen pixels this frame. */
+	uint32_t target = 0; /* Finest level the plan keeps resident. */
+	uint32_t asked = UINT32_MAX; /* Level the plan wants instead of base, and since when. */
+	std::chrono::steady_clock::time_point asked_since;
+	GLuint id = 0;
+	uint32_t base = 0; /* Finest level of id. */
+	size_t bytes = 0; /* Video memory of id. */
+	GLuint next = 0;
+	uint32_t next_base = 0;
+	size_t next_bytes = 0;
+	GLuint pbo = 0;
+	GLsync fence = 0;
+	uint32_t level = 0; /* Level of next being copied. */
+	uint32_t row = 0; /* Rows, or rows of blocks, of it already copied. */
+	std::chrono::steady_clock::time_point begin;
+
+	~tex_entry()
+	{
+		rom_unmap(&file);
+	}
+};
+
+static struct
+{
+	std::vector<std::shared_ptr<struct tex_entry>> entry; /* Handle - 1. */
+	std::map<std::tuple<std::string, int, int>, uint32_t> path; /* Resolved path, kind and shift. */
+	std::map<std::tuple<uint64_t, int, int>, uint32_t> content; /* Hash, kind and shift. */
+	size_t bytes; /* Resident or being uploaded, referenced or not. */
+	uint64_t frame;
+} tex;
+
+/*
+ * Content hash of one file, valid while its size and mtime are the same.
+ * Files of one group were compared byte for byte with the group's file.
+ */
+struct tex_digest
+{
+	struct rom_info info;
+	uint64_t hash;
+	std::string group; /* Empty until tex_prepare compared it. */
+};
+
+/* By file path, filled by tex_prepare on any thread and by tex_load. */
+static struct
+{
+	std::mutex mutex;
+	std::map<std::string, struct tex_digest> file;
+	std::map<uint64_t, std::string> first; /* File each group is compared with, by hash. */
+} tex_digests;
+
+/*
+ * Separators unified, "." and "dir/.." removed, so different spellings of a
+ * path share an entry.
+ */
+static std::string
+tex_resolve(const char* path)
+{
+	std::vector<std::string> part;
+	std::string out, p = path;
+	size_t at = 0;
+
+	std::replace(p.begin(), p.end(), '\\', '/');
+	while (at <= p.size())
+	{
+		size_t end = std::min(p.find('/', at), p.size());
+		std::string name = p.substr(at, end - at);
+
+		if (name == ".." && !part.empty() && part.back() != "..")
+		{
+			part.pop_back();
+		}
+		else if (!name.empty() && name != ".")
+		{
+			part.push_back(name);
+		}
+		at = end + 1;
+	}
+	if (!p.empty() && p[0] == '/')
+	{
+		out = "/";
+	}
+	for (size_t i = 0; i < part.size(); i++)
+	{
+		out += (i ? "/" : "") + part[i];
+	}
+	return out;
+}
+
+static GLenum
+tex_internal(int format)
+{
+	switch (format)
+	{
+	case DDS_BC1:
+		return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case DDS_BC3:
+		return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case DDS_BC4:
+		return GL_COMPRESSED_RED_RGTC1;
+	case DDS_BC5:
+		return GL_COMPRESSED_RG_RGTC2;
+	case DDS_BC7:
+		return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	}
+	return GL_RGB;
+}
+
+/*
+ * Uncompressed formats by channel count.
+ */
+static const struct
+{
+	GLenum internal;
+	GLenum format;
+} tex_layout[4] =
+{
+	{ GL_R8, GL_RED },
+	{ GL_RG8, GL_RG },
+	{ GL_RGB8, GL_RGB },
+	{ GL_RGBA8, GL_RGBA },
+};
+
+/*
+ * RGTC is core since 3.0 and BPTC since 4.2, S3TC is an extension everywhere
+ * but present on every desktop driver.
+ */
+static int
+tex_supported(enum dds_format format)
+{
+#if defined(_WIN64) || defined(_WIN32)
+	(void)format;
+	return 1;
+#else
+	switch (format)
+	{
+	case DDS_BC1:
+	case DDS_BC3:
+		return GLEW_EXT_texture_compression_s3tc;
+	case DDS_BC4:
+	case DDS_BC5:
+		return 1;
+	case DDS_BC7:
+		return GLEW_ARB_texture_compression_bptc;
+	}
+	return 0;
+#endif
+}
+
+/*
+ * GL internal format of a baked dds_format, 0 when the driver lacks it.
+ */
+GLenum
+tex_compressed(int format)
+{
+	return (tex_supported((enum dds_format)format) ? tex_internal(format) : 0);
+}
+
+/*
+ * Maps <path>.dds written by matf_bake when it is at least as new as the
+ * source and the driver takes its format.
+ */
+static int
+tex_baked(struct tex_entry* e)
+{
+	const std::string path = e->path + ".dds";
+	struct rom_info source, baked;
+
+	if (rom_stat(path.c_str(), &baked) || (rom_stat(e->path.c_str(), &source) == 0 && source.mtime > baked.mtime))
+	{
+		return 1;
+	}
+	if (rom_map(&e->file, path.c_str()) || e->file.data == nullptr)
+	{
+		return 1;
+	}
+	if (dds_parse(&e->dds, e->file.data, e->file.size) || e->dds.faces != 1 || !tex_supported(e->dds.format))
+	{
+		std::cout << "texture " << path << " not usable, decoding the source" << std::endl;
+		rom_unmap(&e->file);
+		return 1;
+	}
+	e->format = e->dds.format;
+	e->w = (int)e->dds.w;
+	e->h = (int)e->dds.h;
+	e->first = std::min(e->shift, e->dds.levels - 1);
+	e->finest = e->first;
+	return 0;
+}
+
+/*
+ * Box filtered half size level. Normals are rebuilt from XY, averaged and
+ * renormalized.
+ */
+static void
+tex_downsample(const uint8_t* in, uint32_t w, uint32_t h, int channels, int normal, uint8_t* out)
+{
+	const uint32_t ow = std::max(1u, w / 2), oh = std::max(1u, h / 2);
+
+	for (uint32_t y = 0; y < oh; y++)
+	{
+		for (uint32_t x = 0; x < ow; x++)
+		{
+			float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			uint8_t* o = out + ((size_t)y * ow + x) * channels;
+
+			for (uint32_t k = 0; k < 4; k++)
+			{
+				const uint32_t sx = std::min(w - 1, x * 2 + (k & 1));
+				const uint32_t sy = std::min(h - 1, y * 2 + (k >> 1));
+				const uint8_t* p = in + ((size_t)sy * w + sx) * channels;
+
+				if (normal)
+				{
+					glm::vec2 n = glm::vec2(p[0], p[1]) / 127.5f - 1.0f;
+
+					sum[0] += n.x;
+					sum[1] += n.y;
+					sum[2] += sqrtf(std::max(1.0f - glm::dot(n, n), 0.0f));
+				}
+				else
+				{
+					for (int c = 0; c < channels; c++)
+					{
+						sum[c] += p[c] / 4.0f;
+					}
+				}
+			}
+			if (normal)
+			{
+				glm::vec3 n = glm::vec3(sum[0], sum[1], sum[2]);
+
+				n = (glm::length(n) > 0.0f ? glm::normalize(n) : glm::vec3(0.0f, 0.0f, 1.0f));
+				sum[0] = (n.x + 1.0f) * 127.5f;
+				sum[1] = (n.y + 1.0f) * 127.5f;
+			}
+			for (int c = 0; c < channels; c++)
+			{
+				o[c] = (uint8_t)glm::clamp(sum[c] + 0.5f, 0.0f, 255.0f);
+			}
+		}
+	}
+}
+
+/*
+ * Mip chain of pixels decoded at 1/2^applied of the full size. The full size
+ * is taken as the decoded one times 2^applied, so level sizes agree with
+ * what GL derives from level 0.
+ */
+static void
+tex_mips(struct tex_chain* out, const uint8_t* pixels, uint32_t w, uint32_t h, int channels, uint32_t applied, uint32_t first, int normal)
+{
+	std::vector<uint8_t> scratch[2];
+	const uint8_t* previous = nullptr;
+	uint32_t pw = 0, ph = 0;
+	uint8_t* at;
+	size_t total = 0;
+
+	out->dds = { };
+	out->dds.w = w << applied;
+	out->dds.h = h << applied;
+	out->first = std::max(first, applied);
+	out->channels = channels;
+	/* Sizes of levels finer than applied as well, the plan costs them. */
+	for (out->dds.levels = 0; out->dds.levels < DDS_LEVELS_MAX; )
+	{
+		const uint32_t lw = std::max(1u, out->dds.w >> out->dds.levels), lh = std::max(1u, out->dds.h >> out->dds.levels);
+
+		out->dds.size[out->dds.levels++] = lw * lh * channels;
+		if (lw == 1 && lh == 1)
+		{
+			break;
+		}
+	}
+	out->first = std::min(out->first, out->dds.levels - 1);
+	for (uint32_t i = out->first; i < out->dds.levels; i++)
+	{
+		total += out->dds.size[i];
+	}
+
+	out->mip.resize(total);
+	at = out->mip.data();
+	for (uint32_t i = applied; i < out->dds.levels; i++)
+	{
+		const uint32_t lw = std::max(1u, w >> (i - applied)), lh = std::max(1u, h >> (i - applied));
+		uint8_t* level = at;
+
+		if (i < out->first)
+		{
+			scratch[i & 1].resize(out->dds.size[i]);
+			level = scratch[i & 1].data();
+		}
+		if (previous == nullptr && i < out->first)
+		{
+			level = (uint8_t*)pixels;
+		}
+		else if (previous == nullptr)
+		{
+			memcpy(level, pixels, out->dds.size[i]);
+		}
+		else
+		{
+			tex_downsample(previous, pw, ph, channels, normal, level);
+		}
+		if (i >= out->first)
+		{
+			out->dds.level[i] = level;
+			at += out->dds.size[i];
+		}
+		previous = level;
+		pw = lw;
+		ph = lh;
+	}
+}
+
+/*
+ * Decodes at 1/2^shift of the full size. JPEG files are scaled while
+ * decoding, anything else is decoded whole and its finer levels dropped.
+ */
+static int
+tex_decode(const struct rom_file* file, enum tex_kind kind, uint32_t shift, struct tex_chain* out)
+{
+	const int desired = (kind == TEX_NORMAL ? 3 : 0);
+	uint32_t applied = shift;
+	uint8_t* pixels;
+	int w, h, c = 0;
+
+	if (file->data == nullptr)
+	{
+		return 1;
+	}
+	pixels = jpeg_load(file->data, file->size, 1 << shift, &w, &h, &c, desired);
+	if (pixels == nullptr)
+	{
+		pixels = stbi_load_from_memory(file->data, (int)file->size, &w, &h, &c, desired);
+		applied = 0;
+	}
+	if (pixels == nullptr)
+	{
+		return 1;
+	}
+	c = (desired ? desired : c);
+	if (kind == TEX_NORMAL)
+	{
+		/* Z is rebuilt in the shader, XY are packed down in place. */
+		for (size_t i = 0; i < (size_t)w * h; i++)
+		{
+			pixels[i * 2 + 0] = pixels[i * 3 + 0];
+			pixels[i * 2 + 1] = pixels[i * 3 + 1];
+		}
+		c = 2;
+	}
+	tex_mips(out, pixels, (uint32_t)w, (uint32_t)h, c, applied, shift, kind == TEX_NORMAL);
+	free(pixels); /* stb_image allocates with malloc as well. */
+	return 0;
+}
+
+/*
+ * Makes a decoded chain the entry's levels.
+ */
+static void
+tex_install(struct tex_entry* e, struct tex_chain* chain)
+{
+	e->mip.swap(chain->mip);
+	e->dds = chain->dds;
+	e->first = chain->first;
+	e->channels = chain->channels;
+	e->w = (int)chain->dds.w;
+	e->h = (int)chain->dds.h;
+	chain->mip = std::vector<uint8_t>();
+}
+
+/*
+ * Video memory of levels base and coarser.
+ */
+static size_t
+tex_cost(const struct tex_entry* e, uint32_t base)
+{
+	size_t bytes = 0;
+
+	for (uint32_t i = base; i < e->dds.levels; i++)
+	{
+		bytes += e->dds.size[i];
+	}
+	return bytes;
+}
+
+/*
+ * Finest level no larger than TEX_FLOOR.
+ */
+static uint32_t
+tex_floor(const struct tex_entry* e)
+{
+	uint32_t l = 0;
+
+	while (l + 1 < e->dds.levels && (uint32_t)std::max(e->w, e->h) >> l > TEX_FLOOR)
+	{
+		l++;
+	}
+	return std::max(l, e->first);
+}
+
+/*
+ * Frees decoded levels finer than what the next build needs: the floor
+ * levels, or target when a finer one is still to be uploaded. Called with
+ * no upload reading them.
+ */
+static void
+tex_shed(struct tex_entry* e)
+{
+	const uint32_t floor = tex_floor(e);
+	const uint32_t keep = (e->target < e->base ? std::min(e->target, floor) : floor);
+	std::vector<uint8_t> tail;
+	uint8_t* at;
+
+	if (e->format >= 0 || keep <= e->first)
+	{
+		return;
+	}
+	/* Levels lie one after another, the coarser ones are a single run. */
+	tail.assign(e->dds.level[keep], e->dds.level[keep] + tex_cost(e, keep));
+	at = tail.data();
+	for (uint32_t i = 0; i < e->dds.levels; i++)
+	{
+		e->dds.level[i] = (i < keep ? nullptr : at);
+		at += (i < keep ? 0 : e->dds.size[i]);
+	}
+	e->mip.swap(tail);
+	e->first = keep;
+}
+
+/*
+ * Decodes levels base and coarser again into refined, mapping the file
+ * anew since the first decode let go of it.
+ */
+static void
+tex_request(const std::shared_ptr<struct tex_entry>& e, uint32_t base)
+{
+	e->refine = 1;
+	job_push([e, base]()
+	{
+		struct rom_file file = { };
+
+		if (rom_map(&file, e->path.c_str()) || tex_decode(&file, e->kind, base, &e->refined))
+		{
+			e->refined = { };
+		}
+		rom_unmap(&file);
+		e->refine.store(2, std::memory_order_release);
+	});
+}
+
+/*
+ * Hash of file, mapped from path, taken from tex_digests while the file is
+ * unchanged.
+ */
+static uint64_t
+tex_file_hash(const std::string& path, const struct rom_file& file)
+{
+	struct tex_digest d;
+	int known = (rom_stat(path.c_str(), &d.info) == 0 && d.info.size == file.size);
+
+	if (known)
+	{
+		std::lock_guard<std::mutex> lock(tex_digests.mutex);
+		auto it = tex_digests.file.find(path);
+
+		if (it != tex_digests.file.end() && it->second.info.size == d.info.size && it->second.info.mtime == d.info.mtime)
+		{
+			return it->second.hash;
+		}
+	}
+	d.hash = rom_hash(file.data, file.size) ^ (uint64_t)file.size;
+	if (known)
+	{
+		std::lock_guard<std::mutex> lock(tex_digests.mutex);
+
+		tex_digests.file[path] = d;
+	}
+	return d.hash;
+}
+
+/*
+ * File an entry read, the baked one or the source.
+ */
+static std::string
+tex_file_path(const struct tex_entry& e)
+{
+	return (e.format >= 0 ? e.path + ".dds" : e.path);
+}
+
+/*
+ * Compares file, mapped from path, with the first file of the same hash and
+ * records the group it belongs to. Reads both files whole, so it runs on a
+ * worker only, see tex_prepare.
+ */
+static void
+tex_file_group(const std::string& path, const struct rom_file& file, uint64_t hash)
+{
+	std::string first, group = path;
+
+	{
+		std::lock_guard<std::mutex> lock(tex_digests.mutex);
+		auto it = tex_digests.first.emplace(hash, path).first;
+
+		first = it->second;
+	}
+	if (first != path)
+	{
+		struct rom_file f;
+
+		if (rom_map(&f, first.c_str()) == 0)
+		{
+			if (f.data != nullptr && f.size == file.size && memcmp(f.data, file.data, file.size) == 0)
+			{
+				group = first;
+			}
+			rom_unmap(&f);
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(tex_digests.mutex);
+		auto it = tex_digests.file.find(path);
+
+		/* Unless the file changed and was hashed again meanwhile. */
+		if (it != tex_digests.file.end() && it->second.hash == hash)
+		{
+			it->second.group = group;
+		}
+	}
+}
+
+/*
+ * A hash match is only taken when tex_prepare found the bytes the same
+ * too, files it did not compare get entries of their own. Only looks up
+ * what was recorded, the render thread calls it.
+ */
+static int
+tex_same(const struct tex_entry& other, const struct tex_entry& e)
+{
+	const std::string path[2] = { tex_file_path(other), tex_file_path(e) };
+	std::string group[2];
+
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		struct rom_info info;
+
+		if (rom_stat(path[i].c_str(), &info))
+		{
+			return 0;
+		}
+		std::lock_guard<std::mutex> lock(tex_digests.mutex);
+		auto it = tex_digests.file.find(path[i]);
+
+		if (it == tex_digests.file.end() || it->second.info.size != info.size || it->second.info.mtime != info.mtime)
+		{
+			return 0;
+		}
+		group[i] = it->second.group;
+	}
+	return (!group[0].empty() && group[0] == group[1]);
+}
+
+/*
+ * Hashes the file tex_load will read for path and compares it with any
+ * file of the same hash, so the render thread does neither. Thread safe,
+ * scene loading calls it on its worker.
+ */
+void
+tex_prepare(const char* path)
+{
+	const std::string resolved = tex_resolve(path);
+	std::string file = resolved + ".dds";
+	struct rom_info source, baked;
+	struct rom_file f;
+
+	if (rom_stat(file.c_str(), &baked) || (rom_stat(resolved.c_str(), &source) == 0 && source.mtime > baked.mtime))
+	{
+		file = resolved;
+	}
+	if (rom_map(&f, file.c_str()) == 0)
+	{
+		if (f.data)
+		{
+			tex_file_group(file, f, tex_file_hash(file, f));
+		}
+		rom_unmap(&f);
+	}
+}
+
+/*
+ * Drops the GL objects and every key of an entry.
+ */
+static void
+tex_evict(uint32_t slot)
+{
+	std::shared_ptr<struct tex_entry> e = std::move(tex.entry[slot]);
+
+	for (const std::string& a : e->alias)
+	{
+		tex.path.erase({ a, e->kind, e->shift });
+	}
+	{
+		auto it = tex.content.find({ e->hash, e->kind, e->shift });
+
+		if (it != tex.content.end() && it->second == slot + 1)
+		{
+			tex.content.erase(it);
+		}
+	}
+	if (e->fence)
+	{
+		glDeleteSync(e->fence);
+	}
+	if (e->pbo)
+	{
+		glDeleteBuffers(1, &e->pbo);
+	}
+	if (e->id)
+	{
+		glDeleteTextures(1, &e->id);
+	}
+	if (e->next)
+	{
+		glDeleteTextures(1, &e->next);
+	}
+	tex.bytes -= e->bytes + e->next_bytes;
+}
+
+/*
+ * Returns a referenced handle for path. Paths seen before and files with
+ * the same content as a loaded one share its entry, anything else is mapped
+ * and queued for decoding. The content hash comes from tex_prepare when it
+ * ran for the file, and so does the byte comparison sharing needs. A baked file is ready for upload as is.
+ * Scale 2, 4 or 8 loads the texture at that fraction of its resolution.
+ */
+uint32_t
+tex_load(const char* path, enum tex_kind kind, int scale)
+{
+	const std::string resolved = tex_resolve(path);
+	const uint32_t shift = (scale >= 8 ? 3 : scale >= 4 ? 2 : scale >= 2 ? 1 : 0);
+	std::shared_ptr<struct tex_entry> e;
+	uint32_t slot;
+
+	{
+		auto it = tex.path.find({ resolved, kind, shift });
+
+		if (it != tex.path.end())
+		{
+			tex.entry[it->second - 1]->refs++;
+			return it->second;
+		}
+	}
+
+	e = std::make_shared<struct tex_entry>();
+	e->path = resolved;
+	e->kind = kind;
+	e->shift = shift;
+	e->begin = std::chrono::steady_clock::now();
+	if ((tex_baked(e.get()) == 0 || rom_map(&e->file, resolved.c_str()) == 0) && e->file.data)
+	{
+		std::map<std::tuple<uint64_t, int, int>, uint32_t>::iterator it;
+
+		e->hash = tex_file_hash(tex_file_path(*e), e->file);
+		it = tex.content.find({ e->hash, kind, shift });
+		if (it != tex.content.end() && tex_same(*tex.entry[it->second - 1], *e))
+		{
+			struct tex_entry& same = *tex.entry[it->second - 1];
+
+			std::cout << "texture " << resolved << " shares " << same.path << std::endl;
+			same.alias.push_back(resolved);
+			same.refs++;
+			tex.path[{ resolved, kind, shift }] = it->second;
+			return it->second;
+		}
+	}
+
+	for (slot = 0; slot < tex.entry.size() && tex.entry[slot]; slot++);
+	if (slot == tex.entry.size())
+	{
+		tex.entry.push_back(nullptr);
+	}
+	tex.entry[slot] = e;
+	e->alias.push_back(resolved);
+	e->refs = 1;
+	tex.path[{ resolved, kind, shift }] = slot + 1;
+	if (e->file.data && tex.content.find({ e->hash, kind, shift }) == tex.content.end())
+	{
+		/* A colliding hash of other content keeps the first entry. */
+		tex.content[{ e->hash, kind, shift }] = slot + 1;
+	}
+
+	if (e->format >= 0)
+	{
+		e->base = e->target = e->dds.levels;
+		e->state = TEX_READY;
+		return slot + 1;
+	}
+	job_push([e]()
+	{
+		struct tex_chain chain;
+		uint32_t preview = e->shift;
+		int w, h;
+
+		/* Large JPEG files get a quick coarse decode first. */
+		if (e->file.data && jpeg_size(e->file.data, e->file.size, &w, &h) == 0)
+		{
+			while (preview < 3 && (uint32_t)std::max(w, h) >> (preview + 1) >= TEX_FLOOR)
+			{
+				preview++;
+			}
+		}
+		if (tex_decode(&e->file, e->kind, preview, &chain))
+		{
+			rom_unmap(&e->file);
+			e->state.store(TEX_BROKEN, std::memory_order_release);
+			return;
+		}
+		/* Finer levels are decoded when the plan first wants them. */
+		rom_unmap(&e->file);
+		tex_install(e.get(), &chain);
+		e->finest = std::min(e->shift, e->dds.levels - 1);
+		e->base = e->target = e->dds.levels;
+		e->state.store(TEX_READY, std::memory_order_release);
+	});
+	return slot + 1;
+}
+
+/*
+ * Unreferenced textures are kept for later loads, tex_tick evicts them when
+ * resident memory exceeds settings.vram_mb.
+ */
+void
+tex_release(uint32_t handle)
+{
+	if (handle == 0 || handle > tex.entry.size() || !tex.entry[handle - 1])
+	{
+		return;
+	}
+	tex.entry[handle - 1]->refs--;
+}
+
+GLuint
+tex_get(uint32_t handle, GLuint fallback)
+{
+	struct tex_entry* e;
+
+	if (handle == 0 || handle > tex.entry.size() || !tex.entry[handle - 1])
+	{
+		return fallback;
+	}
+	e = tex.entry[handle - 1].get();
+	e->used = tex.frame;
+	return (e->id ? e->id : fallback);
+}
+
+/*
+ * 1 once the texture has something to show, or never will.
+ */
+int
+tex_ready(uint32_t handle)
+{
+	const struct tex_entry* e;
+
+	if (handle == 0 || handle > tex.entry.size() || !tex.entry[handle - 1])
+	{
+		return 1;
+	}
+	e = tex.entry[handle - 1].get();
+	return (e->id != 0 || e->state.load(std::memory_order_acquire) == TEX_FAILED);
+}
+
+/*
+ * Reports a use of the texture this frame: texels is how many texels across
+ * the whole texture would map one to one to screen pixels, coverage the
+ * screen area of the use. Textures nobody reports keep only the levels up
+ * to TEX_FLOOR, unless the budget has room for what is resident already.
+ */
+void
+tex_want(uint32_t handle, float texels, float coverage)
+{
+	struct tex_entry* e;
+
+	if (handle == 0 || handle > tex.entry.size() || !tex.entry[handle - 1])
+	{
+		return;
+	}
+	e = tex.entry[handle - 1].get();
+	e->want = std::max(e->want, texels);
+	e->coverage += coverage;
+}
+
+/*
+ * Splits settings.vram_mb between referenced textures. Everyone gets the
+ * levels up to TEX_FLOOR, then textures covering most of the screen get
+ * the levels they want, coarser ones when those do not fit. Room left keeps
+ * finer levels that are resident already, so moving the camera back and
+ * forth does not upload them again. A level other than the resident one is
+ * taken only after being asked for TEX_DWELL_MS in a row, so small camera
+ * moves across a level boundary do not rebuild the texture each time.
+ */
+static void
+tex_plan(void)
+{
+	const size_t budget = (size_t)settings.vram_mb * 1024 * 1024;
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	std::vector<struct tex_entry*> order;
+	size_t total = 0;
+
+	for (const std::shared_ptr<struct tex_entry>& e : tex.entry)
+	{
+		const int state = (e ? e->state.load(std::memory_order_acquire) : TEX_FAILED);
+
+		if (e && e->refs > 0 && (state == TEX_READY || state == TEX_UPLOADING || state == TEX_FENCED))
+		{
+			order.push_back(e.get());
+			e->target = tex_floor(e.get());
+			total += tex_cost(e.get(), e->target);
+		}
+		else if (state == TEX_READY)
+		{
+			e->target = e->base;
+		}
+	}
+	std::sort(order.begin(), order.end(), [](const struct tex_entry* a, const struct tex_entry* b) { return a->coverage > b->coverage; });
+
+	for (struct tex_entry* e : order)
+	{
+		uint32_t l = e->finest;
+
+		if (e->want <= 0.0f)
+		{
+			continue;
+		}
+		while (l < e->target && (float)((uint32_t)std::max(e->w, e->h) >> (l + 1)) >= e->want)
+		{
+			l++;
+		}
+		for (; l < e->target; l++)
+		{
+			const size_t extra = tex_cost(e, l) - tex_cost(e, e->target);
+
+			if (total + extra <= budget)
+			{
+				total += extra;
+				e->target = l;
+				break;
+			}
+		}
+	}
+	for (struct tex_entry* e : order)
+	{
+		if (e->id && e->base < e->target && total + tex_cost(e, e->base) - tex_cost(e, e->target) <= budget)
+		{
+			total += tex_cost(e, e->base) - tex_cost(e, e->target);
+			e->target = e->base;
+		}
+	}
+	for (struct tex_entry* e : order)
+	{
+		/* Leaving the floor levels is not held back, detail shows up as soon as it is wanted. */
+		if (e->id == 0 || e->target == e->base || (e->target < e->base && e->base >= tex_floor(e)))
+		{
+			e->asked = UINT32_MAX;
+			continue;
+		}
+		if (e->asked != e->target)
+		{
+			e->asked = e->target;
+			e->asked_since = now;
+		}
+		if (now - e->asked_since < std::chrono::milliseconds(TEX_DWELL_MS))
+		{
+			e->target = e->base;
+		}
+	}
+
+	for (const std::shared_ptr<struct tex_entry>& e : tex.entry)
+	{
+		if (e)
+		{
+			e->want = 0.0f;
+			e->coverage = 0.0f;
+		}
+	}
+}
+
+/*
+ * Least recently used unreferenced entries go first when the textures in use
+ * leave no room for them. Failed ones hold no
+ * memory and go as soon as nothing refers to them.
+ */
+static void
+tex_trim(void)
+{
+	const size_t budget = (size_t)settings.vram_mb * 1024 * 1024;
+
+	for (uint32_t i = 0; i < tex.entry.size(); i++)
+	{
+		if (tex.entry[i] && tex.entry[i]->refs <= 0 && tex.entry[i]->state == TEX_FAILED)
+		{
+			tex_evict(i);
+		}
+	}
+	while (tex.bytes > budget)
+	{
+		uint32_t victim = UINT32_MAX;
+
+		for (uint32_t i = 0; i < tex.entry.size(); i++)
+		{
+			const struct tex_entry* e = tex.entry[i].get();
+
+			if (e && e->refs <= 0 && e->state == TEX_READY && e->id && (victim == UINT32_MAX || e->used < tex.entry[victim]->used))
+			{
+				victim = i;
+			}
+		}
+		if (victim == UINT32_MAX)
+		{
+			break;
+		}
+		std::cout << "texture " << tex.entry[victim]->path << " evicted, " << tex.entry[victim]->bytes / 1024 << " KB" << std::endl;
+		tex_evict(victim);
+	}
+}
+
+/*
+ * Creates the texture holding levels base and coarser and the unpack buffer
+ * its levels are copied through.
+ */
+static void
+tex_build(struct tex_entry* e, uint32_t base)
+{
+	const uint32_t levels = e->dds.levels;
+
+	e->next_base = base;
+	e->next_bytes = tex_cost(e, base);
+	tex.bytes += e->next_bytes;
+	glGenTextures(1, &e->next);
+	glBindTexture(GL_TEXTURE_2D, e->next);
+	for (uint32_t i = base; i < levels; i++)
+	{
+		const GLsizei w = std::max(1, e->w >> i), h = std::max(1, e->h >> i);
+
+		if (e->format >= 0)
+		{
+			glCompressedTexImage2D(GL_TEXTURE_2D, i, tex_internal(e->format), w, h, 0, e->dds.size[i], NULL);
+		}
+		else
+		{
+			glTexImage2D(GL_TEXTURE_2D, i, tex_layout[e->channels - 1].internal, w, h, 0, tex_layout[e->channels - 1].format, GL_UNSIGNED_BYTE, NULL);
+		}
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, base);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	if (e->format < 0 && e->kind == TEX_COLOUR && e->channels <= 2)
+	{
+		/* Grey, with alpha in the second channel. */
+		const GLint swizzle[2][4] = { { GL_RED, GL_RED, GL_RED, GL_ONE }, { GL_RED, GL_RED, GL_RED, GL_GREEN } };
+
+		glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle[e->channels - 1]);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glGenBuffers(1, &e->pbo);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, e->pbo);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)e->next_bytes, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	e->level = base;
+	e->row = 0;
+	if (e->id)
+	{
+		e->begin = std::chrono::steady_clock::now();
+	}
+}
+
+/*
+ * Copies rows, or rows of blocks of a baked file, of every level through the
+ * pixel unpack buffer until the frame's upload budget is spent.
+ */
+static void
+tex_upload(struct tex_entry* e, std::chrono::steady_clock::time_point deadline)
+{
+	const uint32_t levels = e->dds.levels;
+
+	glBindTexture(GL_TEXTURE_2D, e->next);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, e->pbo);
+	while (e->level < levels && std::chrono::steady_clock::now() < deadline)
+	{
+		const uint32_t w = std::max(1u, (uint32_t)e->w >> e->level);
+		const uint32_t h = std::max(1u, (uint32_t)e->h >> e->level);
+		const uint8_t* src = e->dds.level[e->level];
+		const size_t offset = (size_t)(src - e->dds.level[e->next_base]);
+		const size_t pitch = (e->format >= 0 ? (size_t)(w + 3) / 4 * dds_block_size(e->dds.format) : (size_t)w * e->channels);
+		const uint32_t height = (e->format >= 0 ? (h + 3) / 4 : h);
+		const uint32_t rows = std::min(std::max(1u, (uint32_t)(TEX_SLICE_BYTES / pitch)), height - e->row);
+		const size_t at = offset + pitch * e->row;
+		void* dst;
+
+		dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, (GLintptr)at, (GLsizeiptr)(pitch * rows), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		if (dst == nullptr)
+		{
+			break;
+		}
+		memcpy(dst, src + pitch * e->row, pitch * rows);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		if (e->format >= 0)
+		{
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, e->level, 0, e->row * 4, w, std::min(h - e->row * 4, rows * 4), tex_internal(e->format), (GLsizei)(pitch * rows), (void*)at);
+		}
+		else
+		{
+			glTexSubImage2D(GL_TEXTURE_2D, e->level, 0, e->row, w, rows, tex_layout[e->channels - 1].format, GL_UNSIGNED_BYTE, (void*)at);
+		}
+		e->row += rows;
+		if (e->row == height)
+		{
+			e->level++;
+			e->row = 0;
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	if (e->level == levels)
+	{
+		e->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		e->state = TEX_FENCED;
+	}
+}
+
+/*
+ * Called once per frame on the render thread, after the frame's tex_want
+ * calls. Starts uploads for textures whose planned levels differ from the
+ * resident ones until deadline and swaps in fenced ones.
+ */
+void
+tex_tick(std::chrono::steady_clock::time_point deadline)
+{
+	GLint alignment;
+
+	tex.frame++;
+	tex_plan();
+	glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glActiveTexture(GL_TEXTURE0);
+	for (const std::shared_ptr<struct tex_entry>& e : tex.entry)
+	{
+		if (!e)
+		{
+			continue;
+		}
+		switch (e->state.load(std::memory_order_acquire))
+		{
+		default:
+			break;
+		case TEX_BROKEN:
+			std::cout << "texture issue " << e->path << std::endl;
+			e->state = TEX_FAILED;
+			break;
+		case TEX_READY:
+			if (e->refine.load(std::memory_order_acquire) == 2)
+			{
+				if (e->refined.dds.levels == 0)
+				{
+					/* Stays at what is in memory. */
+					std::cout << "texture " << e->path << " could not be decoded again" << std::endl;
+					e->finest = e->first;
+				}
+				else
+				{
+					std::cout << "texture " << e->path << " decoded again from " << std::max(1u, e->refined.dds.w >> e->refined.first) << "x" << std::max(1u, e->refined.dds.h >> e->refined.first) << std::endl;
+					tex_install(e.get(), &e->refined);
+				}
+				e->refine = 0;
+			}
+			if (e->target == e->base || std::chrono::steady_clock::now() >= deadline)
+			{
+				break;
+			}
+			{
+				/* The coarse levels first, so something shows up quickly. */
+				const uint32_t base = (e->id ? e->target : std::max(e->target, tex_floor(e.get())));
+
+				if (base < e->first)
+				{
+					if (e->refine == 0)
+					{
+						tex_request(e, base);
+					}
+					break;
+				}
+				tex_build(e.get(), base);
+				e->state = TEX_UPLOADING;
+				tex_upload(e.get(), deadline);
+			}
+			break;
+		case TEX_UPLOADING:
+			tex_upload(e.get(), deadline);
+			break;
+		case TEX_FENCED:
+		{
+			GLenum status = glClientWaitSync(e->fence, 0, 0);
+
+			if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+			{
+				glDeleteSync(e->fence);
+				glDeleteBuffers(1, &e->pbo);
+				if (e->id)
+				{
+					glDeleteTextures(1, &e->id);
+				}
+				tex.bytes -= e->bytes;
+				e->fence = 0;
+				e->pbo = 0;
+				e->id = e->next;
+				e->base = e->next_base;
+				e->bytes = e->next_bytes;
+				e->next = 0;
+				e->next_bytes = 0;
+				tex_shed(e.get());
+				e->state = TEX_READY;
+				std::cout << "texture " << e->path << " " << std::max(1, e->w >> e->base) << "x" << std::max(1, e->h >> e->base) << " of " << e->w << "x" << e->h
+					<< ", " << e->bytes / 1024 << " KB resident after " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - e->begin).count() << " ms" << std::endl;
+			}
+			break;
+		}
+		}
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+	tex_trim();
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+enum tex_kind
+{
+	TEX_COLOUR,
+	TEX_NORMAL, /* Stored as XY only, the shader rebuilds Z. */
+};
+
+/*
+ * Material textures are decoded on worker threads and uploaded a slice per
+ * frame. Handles are 0 for no texture, tex_get returns the fallback until the
+ * texture is resident. Which mip levels are resident follows the tex_want
+ * reports of each frame and settings.vram_mb. tex_tick uploads until the
+ * frame's deadline, shared with the scene upload. tex_prepare may run ahead
+ * of tex_load on any thread to hash the file there. Only files it found
+ * the same byte for byte share an entry.
+ */
+extern void tex_prepare(const char* path);
+extern uint32_t tex_load(const char* path, enum tex_kind kind, int scale);
+extern void tex_release(uint32_t handle);
+extern GLuint tex_get(uint32_t handle, GLuint fallback);
+extern int tex_ready(uint32_t handle);
+extern void tex_want(uint32_t handle, float texels, float coverage);
+extern void tex_tick(std::chrono::steady_clock::time_point deadline);
+extern GLenum tex_compressed(int format);